@@ -11,9 +11,6 @@
 #define PIT_PORT_CONTROL          0x43                /* Control port. */
 #define PIT_PORT_COUNTER(CHANNEL) (0x40 + (CHANNEL))  /* Counter port. */
 
-/* PIT cycles per second. */
-#define PIT_HZ 1193180
-
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -35,6 +32,10 @@
        of the period.  This is useful for hooking up to an
        interrupt controller to generate a periodic interrupt.
 
+     - Mode 0 is a one-shot: the channel's output rises once the
+       count runs out, and stays high until the channel is
+       reprogrammed.  See pit_start_oneshot().
+
      - Mode 3 is a square wave: for the first half of the period
        it is 1, for the second half it is 0.  This is useful for
        generating a tone on a speaker.
@@ -81,3 +82,73 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Starts CHANNEL counting down COUNT PIT cycles in mode 0, so
+   that its output rises, once, when the count runs out.  For
+   channel 0 this raises a single timer interrupt COUNT cycles
+   from now.  A COUNT of 0 is treated as 65536.  After the count
+   runs out the counter wraps around and keeps counting, without
+   raising further interrupts, until the channel is
+   reprogrammed. */
+void
+pit_start_oneshot (int channel, uint16_t count)
+{
+  enum intr_level old_level;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, (channel << 6) | 0x30);
+  outb (PIT_PORT_COUNTER (channel), count);
+  outb (PIT_PORT_COUNTER (channel), count >> 8);
+  intr_set_level (old_level);
+}
+
+/* Returns the current value of CHANNEL's counter, that is, the
+   number of PIT cycles left in its current period or
+   count. */
+uint16_t
+pit_read_counter (int channel)
+{
+  enum intr_level old_level;
+  uint8_t lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Latch the counter, then read it low byte first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, channel << 6);
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  return lo | (hi << 8);
+}
+
+/* Latches CHANNEL's counter and status together, with the
+   8254's read-back command, stores the counter's value in
+   *COUNT, and returns the state of the channel's output.  In
+   mode 0 the output rises when the count runs out and stays high
+   until the channel is reprogrammed, so it shows whether a
+   one-shot has expired even after the counter has wrapped
+   around. */
+bool
+pit_read_back (int channel, uint16_t *count)
+{
+  enum intr_level old_level;
+  uint8_t status, lo, hi;
+
+  ASSERT (channel == 0 || channel == 2);
+
+  /* Read-back command for this channel, latching both count and
+     status.  The status byte is read first. */
+  old_level = intr_disable ();
+  outb (PIT_PORT_CONTROL, 0xc0 | (2 << channel));
+  status = inb (PIT_PORT_COUNTER (channel));
+  lo = inb (PIT_PORT_COUNTER (channel));
+  hi = inb (PIT_PORT_COUNTER (channel));
+  intr_set_level (old_level);
+
+  *count = lo | (hi << 8);
+  return (status & 0x80) != 0;
+}
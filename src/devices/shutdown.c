@@ -1,10 +1,13 @@
 #include "devices/shutdown.h"
 #include <console.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
@@ -21,6 +24,7 @@
 static enum shutdown_type how = SHUTDOWN_NONE;
 
 static void print_stats (void);
+static void power_off (bool sync) NO_RETURN;
 
 /* Shuts down the machine in the way configured by
    shutdown_configure().  If the shutdown type is SHUTDOWN_NONE
@@ -38,6 +42,10 @@ shutdown (void)
       shutdown_reboot ();
       break;
 
+    case SHUTDOWN_CRASH:
+      power_off (false);
+      break;
+
     default:
       /* Nothing to do. */
       break;
@@ -86,12 +94,22 @@ shutdown_reboot (void)
    as long as we're running on Bochs or QEMU. */
 void
 shutdown_power_off (void)
+{
+  power_off (true);
+}
+
+/* Powers down the machine.  If SYNC is false, skips writing back
+   the file system first, as if the power had failed, so that
+   tests can check what was already durable. */
+static void
+power_off (bool sync UNUSED)
 {
   const char s[] = "Shutdown";
   const char *p;
 
 #ifdef FILESYS
-  filesys_done ();
+  if (sync)
+    filesys_done ();
 #endif
 
   print_stats ();
@@ -123,6 +141,8 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
 #endif
@@ -9,6 +9,7 @@ enum shutdown_type
     SHUTDOWN_NONE,              /* Loop forever. */
     SHUTDOWN_POWER_OFF,         /* Power off the machine (if possible). */
     SHUTDOWN_REBOOT,            /* Reboot the machine (if possible). */
+    SHUTDOWN_CRASH,             /* Power off without syncing the disk. */
   };
 
 void shutdown (void);
@@ -20,11 +20,33 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* List of threads sleeping in timer_sleep(), in order of
+   increasing wake_tick.  Threads on this list are blocked, and
+   it is only touched with interrupts off. */
+static struct list sleep_list;
+
+/* Tickless idle.
+
+   While the idle thread waits for an interrupt, the PIT is
+   switched from a periodic interrupt every tick to a single
+   interrupt at the earliest sleeper's wake-up tick, and the
+   interrupt handler then accounts for all of the ticks that
+   passed.  The 16-bit PIT counter limits one such interrupt to
+   ONESHOT_MAX_TICKS ticks. */
+bool timer_tickless;
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+#define ONESHOT_MAX_TICKS (UINT16_MAX / TICK_CYCLES)
+static int oneshot_ticks;       /* Ticks credited by the pending
+                                   one-shot interrupt, 0 if none. */
+static uint16_t oneshot_cycles; /* PIT count the one-shot started at. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static bool wake_tick_less (const struct list_elem *,
+                            const struct list_elem *, void *aux);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -36,6 +58,7 @@ void
 timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
+  list_init (&sleep_list);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
@@ -85,15 +108,93 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks on sleep_list until timer_interrupt() finds
+   that its wake-up tick has arrived, so it costs nothing while
+   asleep. */
 void
 timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  old_level = intr_disable ();
+  cur->wake_tick = timer_ticks () + ticks;
+  list_insert_ordered (&sleep_list, &cur->elem, wake_tick_less, NULL);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   waits for an interrupt.  In tickless mode, replaces the
+   periodic timer interrupt by a single interrupt at the next
+   wake-up tick on sleep_list, or ONESHOT_MAX_TICKS from now if
+   that is sooner. */
+void
+timer_idle_enter (void)
+{
+  int64_t idle_ticks = ONESHOT_MAX_TICKS;
+  uint16_t left;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!timer_tickless || oneshot_ticks != 0)
+    return;
+
+  if (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wake_tick - ticks < idle_ticks)
+        idle_ticks = t->wake_tick - ticks;
+    }
+  if (idle_ticks <= 1)
+    return;
+
+  /* Keep the current, partly elapsed tick, so that the tick
+     boundaries do not drift. */
+  left = pit_read_counter (0);
+  if (left == 0 || left > TICK_CYCLES)
+    return;
+  oneshot_ticks = idle_ticks;
+  oneshot_cycles = left + (idle_ticks - 1) * TICK_CYCLES;
+  pit_start_oneshot (0, oneshot_cycles);
+}
+
+/* Called with interrupts off when a thread other than the idle
+   thread is about to run.  If a one-shot interrupt set up by
+   timer_idle_enter() is pending, brings it forward to the next
+   tick boundary, so that the thread is not left running without
+   timer ticks.  The ticks that passed are accounted for when
+   that interrupt arrives. */
+void
+timer_idle_exit (void)
+{
+  uint16_t left, cycles;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (oneshot_ticks == 0)
+    return;
+
+  /* If the count already ran out, the interrupt is pending.  The
+     counter cannot tell: in mode 0 it wraps around and keeps
+     counting down, so it may look as though the count has far to
+     go.  The channel's output, which stays high, can. */
+  if (pit_read_back (0, &left))
+    return;
+
+  cycles = left % TICK_CYCLES;
+  if (cycles == 0)
+    cycles = TICK_CYCLES;
+  oneshot_ticks -= (left - cycles) / TICK_CYCLES;
+  oneshot_cycles = cycles;
+  pit_start_oneshot (0, cycles);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -170,8 +271,48 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  int elapsed = 1;
+
+  /* Back from tickless idle: account for every tick that passed
+     and resume periodic interrupts. */
+  if (oneshot_ticks != 0)
+    {
+      elapsed = oneshot_ticks;
+      oneshot_ticks = 0;
+      pit_configure_channel (0, 2, TIMER_FREQ);
+    }
+
+  while (elapsed-- > 0)
+    {
+      ticks++;
+
+      /* Wake sleepers whose time has come.  The list is sorted,
+         so this stops at the first thread that must keep
+         sleeping. */
+      while (!list_empty (&sleep_list))
+        {
+          struct thread *t = list_entry (list_front (&sleep_list),
+                                         struct thread, elem);
+          if (t->wake_tick > ticks)
+            break;
+          list_pop_front (&sleep_list);
+          thread_unblock (t);
+        }
+
+      thread_tick ();
+    }
+}
+
+/* Orders threads on sleep_list by wake_tick.  Threads with equal
+   wake_tick stay in the order they went to sleep. */
+static bool
+wake_tick_less (const struct list_elem *a_, const struct list_elem *b_,
+                void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->wake_tick < b->wake_tick;
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -2,11 +2,17 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* If true, the timer stops interrupting every tick while the CPU
+   is idle.  Controlled by kernel command-line option
+   "-tickless". */
+extern bool timer_tickless;
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -24,6 +30,10 @@ void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
 void timer_ndelay (int64_t nanoseconds);
 
+/* Tickless idle. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 void timer_print_stats (void);
 
 #endif /* devices/timer.h */
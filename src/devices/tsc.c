@@ -0,0 +1,81 @@
+#include "devices/tsc.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/* High-resolution monotonic clock based on the time stamp
+   counter (TSC), which counts CPU cycles.
+
+   The TSC runs at an unknown rate, so tsc_calibrate() measures
+   it against the timer tick at boot.  Afterward, converting a
+   cycle count to nanoseconds takes a multiply and a shift:
+   ns = cycles * ns_mult / 2**ns_shift, with ns_shift chosen as
+   large as possible while ns_mult still fits in 32 bits. */
+
+/* Number of timer ticks to measure the TSC over. */
+#define CALIBRATION_TICKS ((TIMER_FREQ + 19) / 20)
+
+static uint64_t tsc_hz;         /* TSC cycles per second. */
+static uint64_t tsc_base;       /* TSC value at base_ns. */
+static int64_t base_ns;         /* Nanoseconds since boot at tsc_base. */
+static uint32_t ns_mult;        /* Nanoseconds per cycle, scaled. */
+static int ns_shift;            /* Scale of ns_mult, as a power of 2. */
+
+/* Measures the rate of the TSC against the timer.  Interrupts
+   must be turned on. */
+void
+tsc_calibrate (void)
+{
+  int64_t start;
+  uint64_t begin, end;
+
+  ASSERT (intr_get_level () == INTR_ON);
+  printf ("Calibrating TSC...  ");
+
+  /* Start at a tick boundary. */
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  begin = tsc_read ();
+  start++;
+
+  while (timer_ticks () < start + CALIBRATION_TICKS)
+    barrier ();
+  end = tsc_read ();
+
+  tsc_hz = (end - begin) * TIMER_FREQ / CALIBRATION_TICKS;
+  ASSERT (tsc_hz > 0);
+  for (ns_shift = 32; ns_shift > 0; ns_shift--)
+    if ((1000000000ULL << ns_shift) / tsc_hz <= UINT32_MAX)
+      break;
+  ns_mult = (1000000000ULL << ns_shift) / tsc_hz;
+
+  /* Line the clock up with the timer tick at BEGIN. */
+  base_ns = start * (1000000000 / TIMER_FREQ);
+  tsc_base = begin;
+
+  printf ("%'"PRIu64" cycles/s.\n", tsc_hz);
+}
+
+/* Returns the number of nanoseconds since the OS booted.  The
+   value never decreases.  Until tsc_calibrate() has run, it only
+   has the resolution of a timer tick. */
+int64_t
+tsc_ns (void)
+{
+  uint64_t cycles;
+  uint32_t hi, lo;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (1000000000 / TIMER_FREQ);
+
+  /* Multiply in two halves so that neither product overflows. */
+  cycles = tsc_read () - tsc_base;
+  hi = cycles >> 32;
+  lo = cycles;
+  return base_ns + (((uint64_t) hi * ns_mult) << (32 - ns_shift))
+                 + (((uint64_t) lo * ns_mult) >> ns_shift);
+}
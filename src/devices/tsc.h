@@ -0,0 +1,19 @@
+#ifndef DEVICES_TSC_H
+#define DEVICES_TSC_H
+
+#include <stdint.h>
+
+void tsc_calibrate (void);
+int64_t tsc_ns (void);
+
+/* Returns the current value of the CPU's time stamp counter,
+   which counts CPU cycles.  See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+tsc_read (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* devices/tsc.h */
@@ -1,8 +1,8 @@
+#include "filesys/buffer-cache.h"
 #include <stdbool.h>
 #include "threads/synch.h"
 
-#define NUM_ENTRIES 64
-#define NUM_SECTOR_BYTES 512
+#define CACHE_NO_OWNER ((block_sector_t) -1)
 
 
 struct cache_entry{
@@ -11,6 +11,8 @@ struct cache_entry{
 	bool dirty;
 	bool use;
 	bool valid;
+	bool pinned;	/* Held by the journal; must not be evicted. */
+	block_sector_t owner;	/* Inode whose data this is, or CACHE_NO_OWNER. */
 
 	char data[NUM_SECTOR_BYTES];
 };
@@ -26,17 +28,19 @@ struct cache_buffer{
 struct cache_buffer cache_buffer;
 struct lock cache_lock;
 
-void advance_clock_hand(int *clock_hand) {
+static void advance_clock_hand(int *clock_hand) {
 	*clock_hand = (*clock_hand + 1) % NUM_ENTRIES;
 }
 
-void cache_entry_init(struct cache_entry *cache_entry) {
+static void cache_entry_init(struct cache_entry *cache_entry) {
 	cache_entry->valid = false;
 	cache_entry->use = false;
 	cache_entry->dirty = false;
+	cache_entry->pinned = false;
+	cache_entry->owner = CACHE_NO_OWNER;
 }
 
-void cache_init() {
+void cache_init(void) {
 	lock_init(&cache_lock);
 	int i;
 	
@@ -48,12 +52,16 @@ void cache_init() {
 	}
 }
 
-struct cache_entry *cache_fetch_block(block_sector_t sector) {
+static struct cache_entry *cache_fetch_block(block_sector_t sector) {
 	struct cache_entry *cache_entries = cache_buffer.cache_entries;
 	struct cache_entry *temp;
 	int clock_hand;
 	while (true) {
 		clock_hand = cache_buffer.clock_hand;
+		if (cache_entries[clock_hand].valid && cache_entries[clock_hand].pinned) {
+			advance_clock_hand(&cache_buffer.clock_hand);
+			continue;
+		}
 		if (!cache_entries[clock_hand].valid || !cache_entries[clock_hand].use) {
 			if (!cache_entries[clock_hand].use && cache_entries[clock_hand].valid) {
 				if (cache_entries[clock_hand].dirty) {
@@ -62,6 +70,8 @@ struct cache_entry *cache_fetch_block(block_sector_t sector) {
 			}
 			block_read(fs_device, sector, cache_entries[clock_hand].data);
 			cache_entries[clock_hand].valid = true;
+			cache_entries[clock_hand].dirty = false;
+			cache_entries[clock_hand].owner = CACHE_NO_OWNER;
 			cache_entries[clock_hand].use = true;
 			cache_entries[clock_hand].sector = sector;
 
@@ -75,7 +85,7 @@ struct cache_entry *cache_fetch_block(block_sector_t sector) {
 	}
 }
 
-struct cache_entry *get_cache_entry(block_sector_t sector) {
+static struct cache_entry *get_cache_entry(block_sector_t sector) {
 	struct cache_entry *cache_entry;
 	int i;
 	for (i = 0; i < NUM_ENTRIES; i++) {
@@ -105,6 +115,17 @@ void write_cache(block_sector_t sector, void* buffer) {
 	cache_entry->dirty = true;
 }
 
+/* Like write_cache(), but also records that SECTOR holds data of
+   the inode in sector OWNER, so cache_flush_inode() can find it. */
+void write_cache_inode(block_sector_t sector, void* buffer, block_sector_t owner) {
+	struct cache_entry *cache_entry;
+
+	cache_entry = get_cache_entry(sector);
+	memcpy(cache_entry->data, buffer, 512);
+	cache_entry->dirty = true;
+	cache_entry->owner = owner;
+}
+
 void *get_block(block_sector_t sector) {
     struct cache_entry *cache_entry;
 
@@ -112,14 +133,42 @@ void *get_block(block_sector_t sector) {
     return cache_entry->data;
 }
 
-void cache_flush() {
+void cache_flush(void) {
     struct cache_entry *cache_entry;
     int i;
     for (i = 0; i < NUM_ENTRIES; i++) {
         cache_entry = &cache_buffer.cache_entries[i];
 
-        if (cache_entry->dirty) {
+        if (cache_entry->valid && cache_entry->dirty && !cache_entry->pinned) {
             block_write(fs_device, cache_entry->sector, cache_entry->data);
+            cache_entry->dirty = false;
         }
     }
 }
+
+/* Writes back only the dirty data sectors of the inode in sector
+   OWNER, leaving the rest of the cache alone. */
+void cache_flush_inode(block_sector_t owner) {
+    struct cache_entry *cache_entry;
+    int i;
+    for (i = 0; i < NUM_ENTRIES; i++) {
+        cache_entry = &cache_buffer.cache_entries[i];
+
+        if (cache_entry->valid && cache_entry->dirty && !cache_entry->pinned
+            && cache_entry->owner == owner) {
+            block_write(fs_device, cache_entry->sector, cache_entry->data);
+            cache_entry->dirty = false;
+        }
+    }
+}
+
+/* Pins SECTOR in the cache, so that it is never evicted (and so
+   never written back) until cache_unpin() is called. */
+void cache_pin(block_sector_t sector) {
+	get_cache_entry(sector)->pinned = true;
+}
+
+/* Allows SECTOR to be evicted and written back again. */
+void cache_unpin(block_sector_t sector) {
+	get_cache_entry(sector)->pinned = false;
+}
@@ -1,3 +1,6 @@
+#ifndef FILESYS_BUFFER_CACHE_H
+#define FILESYS_BUFFER_CACHE_H
+
 #include "../threads/synch.h"
 #include <stdint.h>
 #include "filesys/inode.h"
@@ -8,9 +11,14 @@
 struct cache_entry;
 struct cache_buffer;
 
-void cache_init();
-char* cache_fetch_block(block_sector_t);
-char* get_block(block_sector_t);
+void cache_init(void);
+void *get_block(block_sector_t);
 void read_cache(block_sector_t sector, void* buffer);
 void write_cache(block_sector_t sector, void* buffer);
-void cache_flush();
\ No newline at end of file
+void write_cache_inode(block_sector_t sector, void* buffer, block_sector_t owner);
+void cache_flush(void);
+void cache_flush_inode(block_sector_t owner);
+void cache_pin(block_sector_t sector);
+void cache_unpin(block_sector_t sector);
+
+#endif /* filesys/buffer-cache.h */
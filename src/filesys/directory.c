@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
+#include <dirent.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 
 /* A directory. */
@@ -20,8 +23,40 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* Entry names a directory? */
   };
 
+/* Bytes of directory entries read per inode_read_at() call: a
+   whole number of sectors. */
+#define DIR_BATCH_SIZE (2 * BLOCK_SECTOR_SIZE)
+
+/* Reads the entries of a directory in order, a batch of whole
+   sectors at a time.  Since sectors do not hold a whole number of
+   entries, the entry at the end of a batch may be cut short; its
+   bytes are kept and completed by the next batch. */
+struct dir_reader
+  {
+    struct inode *inode;        /* Directory inode. */
+    uint8_t *buf;               /* Batch buffer, or null if none. */
+    size_t next;                /* Offset in BUF of next entry. */
+    size_t len;                 /* Bytes in BUF. */
+    off_t end_ofs;              /* Directory offset just past BUF. */
+  };
+
+static void reader_open (struct dir_reader *, struct inode *, off_t ofs);
+static bool reader_next (struct dir_reader *, struct dir_entry *);
+static void reader_close (struct dir_reader *);
+
+/* Cache of `struct dir's. */
+static struct kmem_cache *dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  dir_cache = kmem_cache_create ("dir", sizeof (struct dir), NULL);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -35,7 +70,7 @@ dir_create (block_sector_t sector, size_t entry_cnt)
 struct dir *
 dir_open (struct inode *inode)
 {
-  struct dir *dir = calloc (1, sizeof (*dir));
+  struct dir *dir = kmem_cache_alloc (dir_cache);
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
@@ -45,7 +80,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
       return NULL;
     }
 }
@@ -73,7 +108,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      kmem_cache_free (dir_cache, dir);
     }
 }
 
@@ -88,28 +123,46 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+
+   If FREE_OFSP is non-null and NAME is not found, also sets
+   *FREE_OFSP to the offset of the first free slot in DIR, or to
+   the end of the directory if there is none, so that dir_add()
+   can check for NAME and find a slot in a single pass. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        struct dir_entry *ep, off_t *ofsp, off_t *free_ofsp)
 {
+  struct dir_reader r;
   struct dir_entry e;
-  size_t ofs;
+  off_t free_ofs = -1;
+  off_t ofs = 0;
+  bool found = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
+  reader_open (&r, dir->inode, 0);
+  for (; reader_next (&r, &e); ofs += sizeof e)
+    if (!e.in_use)
+      {
+        if (free_ofs < 0)
+          free_ofs = ofs;
+      }
+    else if (!strcmp (name, e.name))
       {
         if (ep != NULL)
           *ep = e;
         if (ofsp != NULL)
           *ofsp = ofs;
-        return true;
+        found = true;
+        break;
       }
-  return false;
+  reader_close (&r);
+
+  if (free_ofsp != NULL)
+    *free_ofsp = free_ofs >= 0 ? free_ofs : ofs;
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -129,7 +182,7 @@ dir_lookup (const struct dir *dir, const char *name,
     *inode = inode_reopen (dir->inode);
   else if (strcmp (name, "..") == 0)
     *inode = inode_parent_open (dir->inode);
-  else if (lookup (dir, name, &e, NULL))
+  else if (lookup (dir, name, &e, NULL, NULL))
     *inode = inode_open (e.inode_sector); 
   else
     *inode = NULL;
@@ -139,16 +192,16 @@ dir_lookup (const struct dir *dir, const char *name,
 
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and IS_DIR records whether it is a directory.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
+         bool is_dir)
 {
   struct dir_entry e;
   off_t ofs;
-  struct inode *inode = NULL;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -158,28 +211,18 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  //printf("dir add");
-  if (dir_lookup (dir, name, &inode))
+  /* Check that NAME is not in use, and set OFS to the offset of
+     a free slot in the same pass over DIR.  If there are no free
+     slots, then it will be set to the current end-of-file. */
+  if (!strcmp (name, ".") || !strcmp (name, "..")
+      || lookup (dir, name, NULL, NULL, &ofs))
     goto done;
-  inode_close (inode);
-
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof (e), ofs) == sizeof (e);
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
+  e.is_dir = is_dir;
   success = inode_write_at (dir->inode, &e, sizeof (e), ofs) == sizeof (e);
   success = success && inode_file_add (dir->inode, e.inode_sector, ofs);
 
@@ -254,3 +297,96 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Reads up to CNT in-use entries from DIR, starting at its
+   current position, into ENTRIES.  Reads the directory in
+   batches of DIR_BATCH_SIZE bytes rather than one entry at a
+   time.  Returns the number of entries stored, which is 0 once
+   the directory has no more entries. */
+int
+dir_getdents (struct dir *dir, struct dirent *entries, int cnt)
+{
+  struct dir_reader r;
+  struct dir_entry e;
+  int stored = 0;
+
+  ASSERT (dir != NULL);
+  ASSERT (entries != NULL);
+
+  reader_open (&r, dir->inode, dir->pos);
+  while (stored < cnt && reader_next (&r, &e))
+    {
+      dir->pos += sizeof e;
+      if (e.in_use)
+        {
+          struct dirent *d = &entries[stored++];
+          d->inumber = e.inode_sector;
+          d->is_dir = e.is_dir;
+          strlcpy (d->name, e.name, sizeof d->name);
+        }
+    }
+  reader_close (&r);
+  return stored;
+}
+
+/* Initializes R to read the entries of directory INODE starting
+   at offset OFS.  Falls back to reading one entry at a time if no
+   batch buffer can be allocated. */
+static void
+reader_open (struct dir_reader *r, struct inode *inode, off_t ofs)
+{
+  off_t start = ROUND_DOWN (ofs, BLOCK_SECTOR_SIZE);
+  size_t skip = ofs - start;
+
+  r->inode = inode;
+  r->buf = malloc (DIR_BATCH_SIZE + sizeof (struct dir_entry));
+  r->next = r->len = 0;
+  r->end_ofs = ofs;
+  if (r->buf != NULL)
+    {
+      /* Start at the beginning of OFS's sector. */
+      r->len = inode_read_at (inode, r->buf, DIR_BATCH_SIZE, start);
+      r->end_ofs = start + r->len;
+      r->next = skip < r->len ? skip : r->len;
+    }
+}
+
+/* Stores the next entry of R's directory in *E.  Returns true if
+   successful, false at the end of the directory. */
+static bool
+reader_next (struct dir_reader *r, struct dir_entry *e)
+{
+  if (r->buf == NULL)
+    {
+      off_t bytes = inode_read_at (r->inode, e, sizeof *e, r->end_ofs);
+      r->end_ofs += bytes;
+      return bytes == sizeof *e;
+    }
+
+  if (r->len - r->next < sizeof *e)
+    {
+      /* Carry the start of a cut-short entry over to the next
+         batch, which begins at a sector boundary. */
+      size_t keep = r->len - r->next;
+      off_t bytes;
+
+      memmove (r->buf, r->buf + r->next, keep);
+      bytes = inode_read_at (r->inode, r->buf + keep, DIR_BATCH_SIZE,
+                             r->end_ofs);
+      r->end_ofs += bytes;
+      r->len = keep + bytes;
+      r->next = 0;
+      if (r->len < sizeof *e)
+        return false;
+    }
+  memcpy (e, r->buf + r->next, sizeof *e);
+  r->next += sizeof *e;
+  return true;
+}
+
+/* Releases R's batch buffer. */
+static void
+reader_close (struct dir_reader *r)
+{
+  free (r->buf);
+}
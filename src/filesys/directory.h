@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include "devices/block.h"
 
+struct dirent;
+
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
    After directories are implemented, this maximum length may be
@@ -13,6 +15,8 @@
 
 struct inode;
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -23,8 +27,9 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, block_sector_t);
+bool dir_add (struct dir *, const char *name, block_sector_t, bool is_dir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+int dir_getdents (struct dir *, struct dirent *, int cnt);
 
 #endif /* filesys/directory.h */
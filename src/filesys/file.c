@@ -1,7 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 
 
@@ -13,13 +13,23 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of `struct file's. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  file_cache = kmem_cache_create ("file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode)
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = kmem_cache_alloc (file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -30,7 +40,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
       return NULL;
     }
 }
@@ -51,7 +61,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file);
+      kmem_cache_free (file_cache, file);
     }
 }
 
@@ -115,6 +125,15 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Writes FILE's dirty data and all committed metadata to disk,
+   so that FILE survives a crash. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  inode_flush (file->inode);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -5,6 +5,8 @@
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -17,6 +19,9 @@ off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
 
+/* Durability. */
+void file_sync (struct file *);
+
 /* Preventing writes. */
 void file_deny_write (struct file *);
 void file_allow_write (struct file *);
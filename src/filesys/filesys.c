@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "filesys/buffer-cache.h"
 #include "threads/thread.h"
 
@@ -27,11 +28,14 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
   cache_init();
 
   if (format)
     do_format ();
+  journal_init (format);
 
   free_map_open ();
   thread_current ()->cwd = inode_open (ROOT_DIR_SECTOR);
@@ -43,6 +47,7 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  journal_done ();
   cache_flush();
 }
 
@@ -57,15 +62,30 @@ filesys_create (const char *name, off_t initial_size, bool is_directory)
   block_sector_t inode_sector = 0;
   struct dir *dir = NULL;
   char file_name[NAME_MAX + 1];
+  /* A file too big to allocate in one journal operation is created
+     empty, then grown in steps. */
+  off_t create_size = initial_size <= INODE_GROW_STEP ? initial_size : 0;
   //printf("filesys create");
+  journal_begin ();
   bool success = (parse_path (name, file_name, &dir)
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, is_directory)
-                  && dir_add (dir, file_name, inode_sector));
+                  && inode_create (inode_sector, create_size, is_directory)
+                  && dir_add (dir, file_name, inode_sector, is_directory));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
+  if (success && create_size < initial_size)
+    {
+      struct inode *inode = inode_open (inode_sector);
+
+      success = (inode != NULL
+                 && inode_extend (inode, initial_size) == initial_size);
+      inode_close (inode);
+      if (!success)
+        filesys_remove (name);
+    }
   return success;
 }
 
@@ -98,9 +118,11 @@ filesys_remove (const char *name)
   struct dir *dir = NULL;
   char file_name[NAME_MAX + 1];
   //printf("filesys remove");
+  journal_begin ();
   bool success = (parse_path (name, file_name, &dir)
                  && dir_remove (dir, file_name));
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -124,6 +146,15 @@ filesys_chdir (const char *name)
   return success;
 }
 
+/* Writes all dirty data and commits all metadata updates made so
+   far, so that they survive a crash. */
+void
+filesys_sync (void)
+{
+  cache_flush ();
+  journal_commit ();
+}
+
 static bool
 parse_path (const char *path, char file_name[NAME_MAX + 1],
             struct dir **directory_ptr)
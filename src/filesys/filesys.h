@@ -7,6 +7,8 @@
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the metadata journal. */
+#define JOURNAL_SECTORS 128     /* Number of sectors in the journal. */
 
 /* Block device that contains the file system. */
 struct block *fs_device;
@@ -17,5 +19,6 @@ bool filesys_create (const char *name, off_t initial_size, bool is_directory);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
 bool filesys_chdir (const char *name);
+void filesys_sync (void);
 
 #endif /* filesys/filesys.h */
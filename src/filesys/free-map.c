@@ -1,9 +1,11 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
@@ -39,10 +41,18 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
   lock_init(&mem_lock);
   ignore_mem_lock = false;
 }
 
+/* Returns the number of sectors in the free map file. */
+size_t
+free_map_sectors (void)
+{
+  return DIV_ROUND_UP (bitmap_file_size (free_map), BLOCK_SECTOR_SIZE);
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
@@ -101,7 +111,11 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
   ASSERT (bitmap_all (free_map, sector, cnt));
+  for (i = 0; i < cnt; i++)
+    journal_release (sector + i);
   acquire_lock(&mem_lock);
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
@@ -5,14 +5,20 @@
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "filesys/buffer-cache.c"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Largest file whose data is stored inline in its inode sector,
+   in the space otherwise used by the direct pointers. */
+#define INODE_INLINE_MAX (118 * sizeof (block_sector_t))
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 bool print = 0;
@@ -20,8 +26,12 @@ bool print3 = 0;
 struct inode_disk
   {
    
-   /* Data blocks. */
-    block_sector_t direct[118];           /* Direct pointers. */
+   /* Data blocks, or the data itself if is_inline. */
+    union
+      {
+        block_sector_t direct[118];       /* Direct pointers. */
+        uint8_t inline_data[INODE_INLINE_MAX]; /* Inline file data. */
+      };
     block_sector_t indirect;              /* Indirect pointer. */
     block_sector_t doubly_indirect;       /* Doubly indirect pointer. */
 
@@ -30,6 +40,7 @@ struct inode_disk
     block_sector_t start;                /* inode_disk sector of the parent directory. */
     off_t ofs;                            /* Offset of entry in parent directory. */
     bool isdirectory;                           /* True if this file is a directory. */
+    bool is_inline;                       /* True if data is in inline_data. */
     uint64_t num_files;                   /* The number of subdirectories or files. */
 
     /* Misc. */
@@ -114,11 +125,23 @@ byte_to_sector (const struct inode *inode, off_t pos)
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Cache of `struct inode's. */
+static struct kmem_cache *inode_cache;
+
+/* Constructs an inode in INODE_CACHE. */
+static void
+inode_ctor (void *inode_)
+{
+  struct inode *inode = inode_;
+  lock_init (&inode->file_lock);
+}
+
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
   list_init (&open_inodes);
+  inode_cache = kmem_cache_create ("inode", sizeof (struct inode), inode_ctor);
   thread_current()->cwd = inode_open(ROOT_DIR_SECTOR);
 }
 
@@ -152,9 +175,17 @@ inode_create (block_sector_t sector, off_t length, bool is_directory)
       disk_inode->magic = INODE_MAGIC;
       disk_inode->parent = sector;
       disk_inode->isdirectory = is_directory;
-      success = inode_resize(disk_inode, length);
+      if (length <= (off_t) INODE_INLINE_MAX)
+        {
+          /* Small enough to live in the inode sector itself. */
+          disk_inode->is_inline = true;
+          disk_inode->length = length;
+          success = true;
+        }
+      else
+        success = inode_resize(disk_inode, length);
       if (success)
-        write_cache(sector, disk_inode);
+        journal_write (sector, disk_inode);
       free(disk_inode);
 }
   return success;
@@ -186,13 +217,12 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = kmem_cache_alloc (inode_cache);
   if (inode == NULL)
     return NULL;
 
   /* Initialize. */
   list_push_front (&open_inodes, &inode->elem);
-  lock_init(&inode->file_lock);
   // lock_acquire(&inode->file_lock);
   inode->sector = sector;
   inode->open_cnt = 1;
@@ -278,7 +308,7 @@ inode_resize(struct inode_disk *id, off_t size) {
   
   if (id->indirect == 0 && size <= 118 * 512) {
     id->length = size;
-    write_cache(id->parent, id);
+    journal_write (id->parent, id);
     if (print == 1)
           printf("inode_resize: return 2, id->length = %d \n", id->length);
     /*
@@ -289,7 +319,10 @@ inode_resize(struct inode_disk *id, off_t size) {
   }
   /* if need more than 118*512 B, then use singly indirect ptr */
   
+  /* Each block is linked in as soon as it is allocated, so that
+     the rollback on failure below finds and frees it. */
   block_sector_t buffer[128];
+  bool changed = false;
   memset(buffer, 0, 512);
   if (id->indirect == 0) {
      if (print == 1) 
@@ -301,6 +334,8 @@ inode_resize(struct inode_disk *id, off_t size) {
           printf("inode_resize: return 3 \n");
       return false;
     }
+    journal_write (id->indirect, buffer);
+    journal_write (id->parent, id);
   } else {
     read_cache(id->indirect, buffer);
   }
@@ -309,24 +344,29 @@ inode_resize(struct inode_disk *id, off_t size) {
     if (size <= (118 + j) * 512 && buffer[j] != 0) {
       free_map_release(buffer[j], 1);
       buffer[j] = 0;
+      changed = true;
     }
     if ((size > (118 + j) * 512) && buffer[j] == 0){
       success = free_map_allocate(1, &buffer[j]);
       if (success == 0) {
+        if (changed)
+          journal_write (id->indirect, buffer);
         inode_resize(id, id->length);
         if (print == 1)
           printf("inode_resize: return 4 \n");
         return false;
       }
+      changed = true;
     }
   }
-  write_cache(id->indirect, buffer); //FIX??? write_cache(sector_idx, bounce);
+  if (changed)
+    journal_write (id->indirect, buffer);
 
   if (id->doubly_indirect == 0 && size <= 246 * 512) {
     id->length = size;
     if (print == 1)
           printf("inode_resize: return 2, id->length = %d \n", id->length);
-    write_cache(id->parent, id);
+    journal_write (id->parent, id);
     return true;
   }
 
@@ -342,61 +382,72 @@ inode_resize(struct inode_disk *id, off_t size) {
           printf("inode_resize: return 3 \n");
       return false;
     }
+    journal_write (id->doubly_indirect, buffer2);
+    journal_write (id->parent, id);
   } else {
     read_cache(id->doubly_indirect, buffer2);
   } 
 
+  /* Only the second-level blocks that SIZE needs, or that are
+     still allocated, are visited, and each is written only if it
+     changes. */
   int m = 0;
-  int k = 0;
-
   for (m; m < 128; m++) {
-    if(size <= (246 + 128 * m) * 512 && buffer2[m] != 0) {
-      free_map_release(buffer2[k], 1);
-        buffer2[k] = 0;
-    }
-    if ((size > (246 + 128 *m) * 512) && buffer2[m] == 0) {
-      success = free_map_allocate(1, &buffer2[k]);
-      if (success == 0) {
-        inode_resize(id, id->length);
-        return false;
-      }
-    }
-
+    off_t first = (246 + 128 * m) * 512;  /* First byte it maps. */
     block_sector_t buffer3[128];
+    bool changed3 = false;
+    int k;
+
+    if (size <= first && buffer2[m] == 0)
+      continue;
+
     memset(buffer3, 0, 512);
-    if(buffer2[m] == 0)
+    if (buffer2[m] == 0) {
       success = free_map_allocate(1, &buffer2[m]);
       if (success == 0) {
         inode_resize(id, id->length);
         return false;
       }
-      else {
-        read_cache(buffer2[m], buffer3);
+      journal_write (buffer2[m], buffer3);
+      journal_write (id->doubly_indirect, buffer2);
+    } else {
+      read_cache(buffer2[m], buffer3);
+    }
+
+    for (k = 0; k < 128; k++) {
+      if (size <= first + k * 512 && buffer3[k] != 0) {
+        free_map_release(buffer3[k], 1);
+        buffer3[k] = 0;
+        changed3 = true;
       }
-      for (k; k < 128; k++) {
-        if (size <= (246 + (128 * m + k)) * 512 && buffer3[k] != 0) {
-          free_map_release(buffer3[k], 1);
-          buffer3[k] = 0;
-        }
-        if ((size > (118 + k) * 512) && buffer3[k] == 0) {
-          success = free_map_allocate(1, &buffer3[k]);
-          if (success == 0) {
-            inode_resize(id, id->length);
-            if (print == 1)
-              printf("inode_resize: return 4 \n");
-            return false;
-          }
+      if (size > first + k * 512 && buffer3[k] == 0) {
+        success = free_map_allocate(1, &buffer3[k]);
+        if (success == 0) {
+          if (changed3)
+            journal_write (buffer2[m], buffer3);
+          inode_resize(id, id->length);
+          if (print == 1)
+            printf("inode_resize: return 4 \n");
+          return false;
         }
+        changed3 = true;
       }
-      write_cache(buffer2[m], buffer3);
+    }
+
+    if (size <= first) {
+      /* Now empty, so no longer needed. */
+      free_map_release(buffer2[m], 1);
+      buffer2[m] = 0;
+      journal_write (id->doubly_indirect, buffer2);
+    } else if (changed3)
+      journal_write (buffer2[m], buffer3);
   }
-  write_cache(id->doubly_indirect, buffer2); 
 
 
   id->length = size;
   if (print == 1)
           printf("inode_resize: return 5 \n");
-  write_cache(id->parent, id);
+  journal_write (id->parent, id);
   return true;
 }
 
@@ -413,6 +464,7 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  journal_begin ();
   lock_acquire(&inode->file_lock);
   /* Release resources if this was the last opener. */
   // lock_acquire(&inode->file_lock);
@@ -426,16 +478,19 @@ inode_close (struct inode *inode)
         {
           struct inode_disk *data;
           data = get_block(inode->sector);
+          if (!data->is_inline)
+            free_map_release (data->direct[0],
+                              bytes_to_sectors (data->length));
           free_map_release (inode->sector, 1);
-          free_map_release (data->direct[0],
-                            bytes_to_sectors (data->length));
         }
       lock_release(&inode->file_lock);
+      journal_end ();
     //  printf("inode_close: size of file at close is: %d, inode sector is %d, inode->data.direct[0] is %d \n", inode->data.length, inode->sector, inode->data.direct[0]);
-      free (inode);
+      kmem_cache_free (inode_cache, inode);
       return;
     }
     lock_release(&inode->file_lock);
+    journal_end ();
 }
 
 
@@ -458,6 +513,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
+  struct inode_disk *data = get_block(inode->sector);
+
+  if (data->is_inline)
+    {
+      /* Data is right here in the inode sector. */
+      if (offset < data->length)
+        {
+          bytes_read = data->length - offset < size
+                       ? data->length - offset : size;
+          memcpy (buffer, data->inline_data + offset, bytes_read);
+        }
+      lock_release(&inode->file_lock);
+      return bytes_read;
+    }
 
   while (size > 0)
     {
@@ -507,6 +576,49 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Moves the inline data of INODE, whose on-disk inode is in
+   DATA, out to a newly allocated data sector so that the file can
+   grow past INODE_INLINE_MAX.  METADATA says whether the data
+   sector must go through the journal.  Returns true if
+   successful, false if out of disk space or memory, in which case
+   DATA is unchanged. */
+static bool
+inode_spill (struct inode *inode, struct inode_disk *data, bool metadata)
+{
+  uint8_t *sector_data;
+  off_t length = data->length;
+
+  ASSERT (data->is_inline);
+
+  sector_data = calloc (1, BLOCK_SECTOR_SIZE);
+  if (sector_data == NULL)
+    return false;
+  memcpy (sector_data, data->inline_data, length);
+
+  memset (data->direct, 0, sizeof data->direct);
+  data->is_inline = false;
+  data->length = 0;
+  if (!inode_resize (data, length))
+    {
+      memcpy (data->inline_data, sector_data, length);
+      data->is_inline = true;
+      data->length = length;
+      free (sector_data);
+      return false;
+    }
+  journal_write (inode->sector, data);
+
+  if (length > 0)
+    {
+      if (metadata)
+        journal_write (data->direct[0], sector_data);
+      else
+        write_cache_inode (data->direct[0], sector_data, inode->sector);
+    }
+  free (sector_data);
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -521,27 +633,70 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
 //  printf("inode_write_at: lock acquired by thread: %p \n", thread_current());
   //printf("page fault");
+  journal_begin ();
   lock_acquire(&inode->file_lock);
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  bool metadata;
 
   // lock_acquire(&inode->file_lock);
   if (inode->deny_write_cnt) {
     lock_release(&inode->file_lock);
+    journal_end ();
     return 0;
   }
   // lock_release(&inode->file_lock);
  // if (print == 1)
    //   printf("inode_write_at: data length = %d, size = %d, offset = %d \n", inode->data.length, size, offset);
+  if (offset + size > inode_length (inode) + INODE_GROW_STEP)
+    {
+      /* Too much growth for one journal operation: grow the file
+         in steps first, then write whatever fits. */
+      off_t length;
+
+      lock_release(&inode->file_lock);
+      journal_end ();
+      length = inode_extend (inode, offset + size);
+      if (length <= offset)
+        return 0;
+      if (length < offset + size)
+        size = length - offset;
+      journal_begin ();
+      lock_acquire(&inode->file_lock);
+    }
   struct inode_disk data;
   read_cache(inode->sector, &data);
+  /* Directory contents and the free map are metadata and go
+     through the journal; ordinary file data does not. */
+  metadata = data.isdirectory || inode->sector == FREE_MAP_SECTOR;
+  if (data.is_inline)
+    {
+      if (offset + size <= (off_t) INODE_INLINE_MAX)
+        {
+          /* Still fits inline: update the inode sector only. */
+          memcpy (data.inline_data + offset, buffer, size);
+          if (data.length < offset + size)
+            data.length = offset + size;
+          journal_write (inode->sector, &data);
+          lock_release(&inode->file_lock);
+          journal_end ();
+          return size;
+        }
+      if (!inode_spill (inode, &data, metadata))
+        {
+          lock_release(&inode->file_lock);
+          journal_end ();
+          return 0;
+        }
+    }
   // lock_acquire(&inode->file_lock);
   if(data.length < offset+size) {
     if(!inode_resize(&data, offset+size)) {
        if (print == 1) 
         printf("inode_write_at: resize failed \n");
       lock_release(&inode->file_lock);
+      journal_end ();
       return 0;
     }
   }
@@ -567,7 +722,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
           /* Write full sector directly to disk. */
-          write_cache(sector_idx, buffer + bytes_written);
+          if (metadata)
+            journal_write (sector_idx, buffer + bytes_written);
+          else
+            write_cache_inode(sector_idx, (void *) (buffer + bytes_written),
+                              inode->sector);
         }
       else
         {
@@ -587,7 +746,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
           else
             memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          write_cache(sector_idx, bounce);
+          if (metadata)
+            journal_write (sector_idx, bounce);
+          else
+            write_cache_inode(sector_idx, bounce, inode->sector);
         }
 
       /* Advance. */
@@ -598,9 +760,74 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   free (bounce);
  // printf("inode_write_at: lock released by thread: %p \n", thread_current());
   lock_release(&inode->file_lock);
+  journal_end ();
   return bytes_written;
 }
 
+/* Grows INODE to LENGTH bytes as a series of journal operations,
+   each growing it by at most INODE_GROW_STEP bytes, so that none
+   logs more sectors than journal_begin() reserves.  Must be called
+   without a journal handle open.  Returns the length INODE
+   reached, which is less than LENGTH if the disk filled up. */
+off_t
+inode_extend (struct inode *inode, off_t length)
+{
+  struct inode_disk data;
+
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  for (;;)
+    {
+      off_t target;
+      bool success;
+
+      journal_begin ();
+      lock_acquire(&inode->file_lock);
+      read_cache(inode->sector, &data);
+      if (data.length >= length)
+        {
+          lock_release(&inode->file_lock);
+          journal_end ();
+          return data.length;
+        }
+
+      target = length - data.length < INODE_GROW_STEP
+               ? length : data.length + INODE_GROW_STEP;
+      if (data.is_inline && target <= (off_t) INODE_INLINE_MAX)
+        {
+          memset (data.inline_data + data.length, 0,
+                  target - data.length);
+          data.length = target;
+          journal_write (inode->sector, &data);
+          success = true;
+        }
+      else if (data.is_inline)
+        success = inode_spill (inode, &data,
+                               data.isdirectory
+                               || inode->sector == FREE_MAP_SECTOR);
+      else
+        success = inode_resize (&data, target);
+      lock_release(&inode->file_lock);
+      journal_end ();
+
+      if (!success)
+        return inode_length (inode);
+    }
+}
+
+/* Makes INODE durable: writes back its dirty data sectors, then
+   commits the journal so its metadata follows.  Data goes first
+   so committed metadata never points at stale blocks. */
+void
+inode_flush (struct inode *inode)
+{
+  ASSERT (inode != NULL);
+
+  lock_acquire(&inode->file_lock);
+  cache_flush_inode(inode->sector);
+  lock_release(&inode->file_lock);
+  journal_commit ();
+}
 
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
@@ -696,10 +923,10 @@ inode_file_add (struct inode *parent, block_sector_t sector, off_t ofs)
   read_cache (sector, &inode_sector);
   inode_sector.parent = parent->sector;
   inode_sector.ofs = ofs;
-  write_cache (sector, &inode_sector);
+  journal_write (sector, &inode_sector);
   read_cache (parent->sector, &inode_sector);
   inode_sector.num_files += 1;
-  write_cache (parent->sector, &inode_sector);
+  journal_write (parent->sector, &inode_sector);
   return true;
   /*if (!inode_is_directory (parent))
     return false;
@@ -720,7 +947,7 @@ inode_file_remove (struct inode *inode)
       struct inode_disk inode_sector;
       read_cache (inode->sector, &inode_sector);
       inode_sector.num_files -= 1;
-      write_cache (inode->sector, &inode_sector);
+      journal_write (inode->sector, &inode_sector);
       return true;
     }
   return false;
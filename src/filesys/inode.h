@@ -9,6 +9,10 @@ struct bitmap;
 struct inode_disk;
 struct inode;
 
+/* Most bytes one journal operation grows a file by, which keeps
+   the index blocks it logs within the journal's reservation. */
+#define INODE_GROW_STEP (64 * 1024)
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, bool is_directory);
 bool inode_resize(struct inode_disk *id, off_t size);
@@ -19,6 +23,8 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_extend (struct inode *, off_t length);
+void inode_flush (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
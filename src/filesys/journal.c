@@ -0,0 +1,478 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/buffer-cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Metadata sectors (inodes, indirect blocks, directory contents
+   and the free map) are written with journal_write(), which
+   updates the buffer cache and pins the cached copy so that it
+   cannot reach its home location before it is in the journal.
+   Each file system operation brackets its updates with
+   journal_begin() and journal_end().
+
+   Updates from every operation that ends while a group is open
+   are collected into that group, which is committed with one
+   sequential write once it holds JOURNAL_GROUP_SOFT sectors or
+   when journal_commit() is called.  Until then the sectors stay
+   dirty in the cache, which is what lets many operations share a
+   single commit.
+
+   A group is never committed in the middle of an operation.
+   Instead, journal_begin() reserves room in the group for the
+   most sectors one operation can log, and waits for the group to
+   be committed if that room is not left.  Operations that would
+   otherwise log without bound, such as growing a file by
+   megabytes, are split into bounded ones by their callers (see
+   inode_extend()).
+
+   On-disk layout, starting at JOURNAL_SECTOR:
+
+     - A header sector with the sequence number of the first
+       record that still has to be replayed after a crash.
+
+     - Records, each a descriptor sector followed by a copy of
+       every sector logged in the group.  The descriptor is
+       written after the copies, so a record only counts if its
+       descriptor has the right magic and sequence number.
+
+   When the journal could not take another full group, the cache
+   is flushed right after a commit, while no sector is pinned, so
+   that every logged sector is at its home location, and the
+   header is advanced past all records (a checkpoint). */
+
+/* Identifies journal header and descriptor sectors. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Sectors (logged plus revoked) that fit in one descriptor. */
+#define JOURNAL_DESC_CNT 125
+
+/* A group is committed by the last journal_end() once it holds
+   at least this many sectors. */
+#define JOURNAL_GROUP_SOFT 24
+
+/* Most sectors a group may log or free.  These sectors are pinned
+   in the buffer cache until commit, so this must stay well below
+   NUM_ENTRIES. */
+#define JOURNAL_GROUP_MAX 48
+
+/* Most sectors a group may revoke.  A revoked sector must have
+   been logged since the last checkpoint, so the journal is
+   checkpointed before more sectors than this have been. */
+#define JOURNAL_REVOKE_MAX (JOURNAL_DESC_CNT - JOURNAL_GROUP_MAX)
+
+/* Most sectors one operation logs, not counting the free map.
+   The largest is creating a file: its inode and up to four index
+   blocks, up to two sectors of directory entries, and the
+   directory's inode and up to three new blocks of it. */
+#define JOURNAL_OP_SECTORS 16
+
+/* One past the last journal sector. */
+#define JOURNAL_END (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+/* On-disk journal header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* First record to replay. */
+    uint8_t unused[504];                /* Not used. */
+  };
+
+/* On-disk record descriptor.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   SECTORS holds LOG_CNT logged sectors, whose copies follow the
+   descriptor in order, then REVOKE_CNT sectors freed since they
+   were logged by an earlier record. */
+struct journal_desc
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Record sequence number. */
+    uint16_t log_cnt;                   /* Number of logged sectors. */
+    uint16_t revoke_cnt;                /* Number of revoked sectors. */
+    block_sector_t sectors[JOURNAL_DESC_CNT];
+  };
+
+/* False until journal_init() and after journal_done().  While
+   false, journal_write() is just write_cache(), which is what
+   formatting uses. */
+static bool journal_active;
+
+/* Protects everything below. */
+static struct lock journal_lock;
+static struct condition journal_idle;   /* No open handles. */
+static struct condition journal_room;   /* A group was committed. */
+
+/* Number of threads with an open handle. */
+static int handle_cnt;
+
+/* Sectors reserved in the group for each open handle. */
+static size_t op_max;
+
+/* The running group. */
+static block_sector_t group_log[JOURNAL_GROUP_MAX];
+static size_t log_cnt;
+static block_sector_t group_revoke[JOURNAL_REVOKE_MAX];
+static size_t revoke_cnt;
+
+/* Sectors logged in the running group and then freed.  They are
+   left out of its record, but stay pinned until it commits: their
+   cached contents must not reach disk while the update that freed
+   them can still be lost in a crash. */
+static block_sector_t group_freed[JOURNAL_GROUP_MAX];
+static size_t freed_cnt;
+
+/* Sectors logged by records written since the last checkpoint.
+   A commit checkpoints once there are more than
+   JOURNAL_REVOKE_MAX, so the next group always fits. */
+static block_sector_t ckpt_log[JOURNAL_REVOKE_MAX + JOURNAL_GROUP_MAX];
+static size_t ckpt_cnt;
+
+static uint32_t next_seq;               /* Sequence number of next record. */
+static block_sector_t next_pos;         /* Where the next record goes. */
+
+/* Descriptor buffer, kept off the kernel stack. */
+static struct journal_desc desc;
+
+static void recover (void);
+static void reset (uint32_t seq);
+static void commit_group (void);
+static bool find (const block_sector_t *, size_t cnt, block_sector_t,
+                  size_t *idxp);
+
+/* Initializes the journal.  If FORMAT is true, starts an empty
+   journal, otherwise replays any records committed before the
+   last shutdown or crash.  Must be called after cache_init() and
+   before anything else writes metadata. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof (struct journal_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_idle);
+  cond_init (&journal_room);
+  handle_cnt = 0;
+  log_cnt = revoke_cnt = freed_cnt = 0;
+
+  op_max = JOURNAL_OP_SECTORS + free_map_sectors ();
+  if (op_max > JOURNAL_GROUP_MAX)
+    PANIC ("file system device too large for the journal");
+
+  if (format)
+    reset (0);
+  else
+    recover ();
+  journal_active = true;
+}
+
+/* Commits the running group and checkpoints the journal, so the
+   next boot has nothing to replay. */
+void
+journal_done (void)
+{
+  if (!journal_active)
+    return;
+
+  journal_commit ();
+  lock_acquire (&journal_lock);
+  cache_flush ();
+  reset (next_seq);
+  journal_active = false;
+  lock_release (&journal_lock);
+}
+
+/* Opens a journal handle for the running thread and reserves room
+   for it in the running group.  Handles nest; only the outermost
+   one counts.  Commits the group, or waits for it to be
+   committed, if it has filled up or has no room left. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!journal_active || t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (log_cnt + revoke_cnt + freed_cnt >= JOURNAL_GROUP_SOFT
+         || log_cnt + freed_cnt + (handle_cnt + 1) * op_max
+            > JOURNAL_GROUP_MAX)
+    {
+      if (handle_cnt == 0)
+        commit_group ();
+      else
+        cond_wait (&journal_room, &journal_lock);
+    }
+  handle_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Closes the running thread's journal handle, releasing its
+   reservation.  The last handle to close commits the group if it
+   has filled up. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!journal_active)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--handle_cnt == 0)
+    {
+      if (log_cnt + revoke_cnt + freed_cnt >= JOURNAL_GROUP_SOFT)
+        commit_group ();
+      cond_broadcast (&journal_idle, &journal_lock);
+    }
+  cond_broadcast (&journal_room, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes BUFFER, which is BLOCK_SECTOR_SIZE bytes, to metadata
+   SECTOR through the buffer cache and logs SECTOR in the running
+   group.  Must be called with a handle open, whose reservation
+   the sector is taken from. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  size_t idx;
+
+  if (!journal_active)
+    {
+      write_cache (sector, (void *) buffer);
+      return;
+    }
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  if (!find (group_log, log_cnt, sector, &idx))
+    {
+      if (find (group_freed, freed_cnt, sector, &idx))
+        group_freed[idx] = group_freed[--freed_cnt];
+      else
+        {
+          ASSERT (log_cnt + freed_cnt < JOURNAL_GROUP_MAX);
+          cache_pin (sector);
+        }
+      if (find (group_revoke, revoke_cnt, sector, &idx))
+        group_revoke[idx] = group_revoke[--revoke_cnt];
+      group_log[log_cnt++] = sector;
+    }
+  write_cache (sector, (void *) buffer);
+  lock_release (&journal_lock);
+}
+
+/* Tells the journal that SECTOR has been freed, so that a copy
+   logged earlier must not be replayed over whatever the sector
+   is reused for.  A sector logged by the running group is dropped
+   from its record but stays pinned until the group commits. */
+void
+journal_release (block_sector_t sector)
+{
+  size_t idx;
+
+  if (!journal_active)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (find (group_log, log_cnt, sector, &idx))
+    {
+      group_log[idx] = group_log[--log_cnt];
+      group_freed[freed_cnt++] = sector;
+    }
+  if (find (ckpt_log, ckpt_cnt, sector, NULL)
+      && !find (group_revoke, revoke_cnt, sector, NULL))
+    {
+      ASSERT (revoke_cnt < JOURNAL_REVOKE_MAX);
+      group_revoke[revoke_cnt++] = sector;
+    }
+  lock_release (&journal_lock);
+}
+
+/* Waits for all open handles to close, then commits the running
+   group.  Once this returns, every metadata update made so far
+   survives a crash.  The running thread must not hold a
+   handle. */
+void
+journal_commit (void)
+{
+  if (!journal_active)
+    return;
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (handle_cnt > 0)
+    cond_wait (&journal_idle, &journal_lock);
+  commit_group ();
+  lock_release (&journal_lock);
+}
+
+/* Writes the running group to the journal as one record and
+   unpins its sectors, then checkpoints if the journal could not
+   take another full group.  The journal lock must be held and no
+   handle may be open. */
+static void
+commit_group (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&journal_lock));
+  ASSERT (handle_cnt == 0);
+
+  if (log_cnt + revoke_cnt + freed_cnt == 0)
+    return;
+  ASSERT (next_pos + 1 + log_cnt <= JOURNAL_END);
+
+  /* Sector copies first, then the descriptor that validates
+     them. */
+  for (i = 0; i < log_cnt; i++)
+    block_write (fs_device, next_pos + 1 + i, get_block (group_log[i]));
+
+  memset (&desc, 0, sizeof desc);
+  desc.magic = JOURNAL_MAGIC;
+  desc.seq = next_seq;
+  desc.log_cnt = log_cnt;
+  desc.revoke_cnt = revoke_cnt;
+  memcpy (desc.sectors, group_log, log_cnt * sizeof *group_log);
+  memcpy (desc.sectors + log_cnt, group_revoke,
+          revoke_cnt * sizeof *group_revoke);
+  block_write (fs_device, next_pos, &desc);
+
+  next_pos += 1 + log_cnt;
+  next_seq++;
+
+  for (i = 0; i < log_cnt; i++)
+    {
+      cache_unpin (group_log[i]);
+      if (!find (ckpt_log, ckpt_cnt, group_log[i], NULL))
+        ckpt_log[ckpt_cnt++] = group_log[i];
+    }
+  for (i = 0; i < freed_cnt; i++)
+    cache_unpin (group_freed[i]);
+  log_cnt = revoke_cnt = freed_cnt = 0;
+
+  /* With nothing pinned, flushing the cache writes every logged
+     sector home, so the records are no longer needed. */
+  if (next_pos + 1 + JOURNAL_GROUP_MAX > JOURNAL_END
+      || ckpt_cnt > JOURNAL_REVOKE_MAX)
+    {
+      cache_flush ();
+      reset (next_seq);
+    }
+  cond_broadcast (&journal_room, &journal_lock);
+}
+
+/* Replays every valid record in the journal to its home sectors,
+   skipping sector copies revoked by a later record, then empties
+   the journal.  Panics if there is no journal, since the sectors
+   where it belongs then hold file system data that an empty
+   journal would overwrite. */
+static void
+recover (void)
+{
+  struct journal_header header;
+  struct journal_desc *descs;
+  block_sector_t pos;
+  uint32_t seq;
+  size_t record_cnt = 0;
+  size_t i, j, k;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("file system has no journal; reformat it with -f");
+
+  descs = malloc ((JOURNAL_SECTORS - 1) * sizeof *descs);
+  if (descs == NULL)
+    PANIC ("can't allocate journal recovery buffer");
+
+  /* Find the valid records. */
+  seq = header.seq;
+  for (pos = JOURNAL_SECTOR + 1; pos < JOURNAL_END; )
+    {
+      struct journal_desc *d = &descs[record_cnt];
+
+      block_read (fs_device, pos, d);
+      if (d->magic != JOURNAL_MAGIC || d->seq != seq
+          || d->log_cnt + d->revoke_cnt > JOURNAL_DESC_CNT
+          || pos + 1 + d->log_cnt > JOURNAL_END)
+        break;
+      record_cnt++;
+      seq++;
+      pos += 1 + d->log_cnt;
+    }
+
+  /* Replay them in order. */
+  pos = JOURNAL_SECTOR + 1;
+  for (i = 0; i < record_cnt; i++)
+    {
+      for (k = 0; k < descs[i].log_cnt; k++)
+        {
+          block_sector_t sector = descs[i].sectors[k];
+          bool revoked = false;
+
+          for (j = i + 1; j < record_cnt && !revoked; j++)
+            revoked = find (descs[j].sectors + descs[j].log_cnt,
+                            descs[j].revoke_cnt, sector, NULL);
+          if (!revoked)
+            {
+              block_read (fs_device, pos + 1 + k, &header);
+              block_write (fs_device, sector, &header);
+            }
+        }
+      pos += 1 + descs[i].log_cnt;
+    }
+  free (descs);
+
+  if (record_cnt > 0)
+    printf ("journal: replayed %zu records.\n", record_cnt);
+  reset (seq);
+}
+
+/* Writes an empty journal whose next record will have sequence
+   number SEQ. */
+static void
+reset (uint32_t seq)
+{
+  struct journal_header header;
+
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+
+  next_seq = seq;
+  next_pos = JOURNAL_SECTOR + 1;
+  ckpt_cnt = 0;
+}
+
+/* Returns true if SECTOR is among the CNT sectors in ARRAY, and
+   stores its index in *IDXP if IDXP is non-null. */
+static bool
+find (const block_sector_t *array, size_t cnt, block_sector_t sector,
+      size_t *idxp)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (array[i] == sector)
+      {
+        if (idxp != NULL)
+          *idxp = i;
+        return true;
+      }
+  return false;
+}
@@ -0,0 +1,16 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_release (block_sector_t);
+void journal_commit (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,19 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Maximum length of a name in a struct dirent.
+   Matches NAME_MAX in filesys/directory.h. */
+#define DIRENT_NAME_MAX 14
+
+/* A directory entry, as filled in by the getdents() system
+   call.  Shared between the kernel and user programs. */
+struct dirent
+  {
+    int inumber;                        /* Inode number of the entry. */
+    bool is_dir;                        /* True if entry is a directory. */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated file name. */
+  };
+
+#endif /* lib/dirent.h */
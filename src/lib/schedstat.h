@@ -0,0 +1,18 @@
+#ifndef __LIB_SCHEDSTAT_H
+#define __LIB_SCHEDSTAT_H
+
+#include <stdint.h>
+
+/* Scheduler statistics for a thread, as filled in by the
+   schedstat() system call.  Shared between the kernel and user
+   programs.  Times are in nanoseconds. */
+struct schedstat
+  {
+    unsigned voluntary_switches;   /* Gave up the CPU by blocking. */
+    unsigned involuntary_switches; /* Gave up the CPU while runnable. */
+    int64_t ready_ns;              /* Time spent waiting for the CPU. */
+    int64_t blocked_ns;            /* Time spent blocked. */
+    int64_t max_latency_ns;        /* Longest single wait for the CPU. */
+  };
+
+#endif /* lib/schedstat.h */
@@ -29,7 +29,17 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+    SYS_FSYNC,                  /* Writes a file's data to disk. */
+    SYS_SYNC,                   /* Writes all file system data to disk. */
+
+    /* Timing. */
+    SYS_CLOCK,                  /* Reads the monotonic clock. */
+    SYS_SCHEDSTAT,              /* Reads scheduler statistics. */
+
+    /* Project 3, copy-on-write. */
+    SYS_FORK                    /* Duplicate this process. */
   };
 
 #endif /* lib/syscall-nr.h */
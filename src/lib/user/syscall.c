@@ -188,3 +188,41 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+getdents (int fd, struct dirent *entries, unsigned cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+int
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
+
+void
+schedstat (struct schedstat *stats)
+{
+  syscall1 (SYS_SCHEDSTAT, stats);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
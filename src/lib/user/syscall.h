@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <dirent.h>
+#include <schedstat.h>
+#include <stdint.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,5 +48,15 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+int getdents (int fd, struct dirent *entries, unsigned cnt);
+int fsync (int fd);
+void sync (void);
+
+/* Timing. */
+int64_t clock_ns (void);
+void schedstat (struct schedstat *);
+
+/* Project 3, copy-on-write. */
+pid_t fork (void);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,23 @@
+/* Passes getdents() a count so large that the size of the
+   buffer it describes wraps around to a few bytes.  The process
+   must be terminated with -1 exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  static struct dirent entries[1];
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK (create ("a/c", 0), "create \"a/c\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+
+  /* 0xcccccccd * sizeof (struct dirent) is 4 modulo 2**32. */
+  getdents (fd, entries, 0xcccccccd);
+  fail ("should not have survived getdents()");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dir-getdents-huge) begin
+(dir-getdents-huge) mkdir "a"
+(dir-getdents-huge) create "a/b"
+(dir-getdents-huge) create "a/c"
+(dir-getdents-huge) open "a"
+dir-getdents-huge: exit(-1)
+EOF
+pass;
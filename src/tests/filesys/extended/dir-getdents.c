@@ -0,0 +1,32 @@
+/* Creates a directory with a few files and a subdirectory, then
+   reads all of its entries with a single getdents() call. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  struct dirent entries[8];
+  int fd, cnt;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 0), "create \"a/b\"");
+  CHECK (create ("a/c", 0), "create \"a/c\"");
+  CHECK (mkdir ("a/d"), "mkdir \"a/d\"");
+  CHECK ((fd = open ("a")) > 1, "open \"a\"");
+
+  cnt = getdents (fd, entries, 8);
+  CHECK (cnt == 3, "getdents \"a\" returned %d entries", cnt);
+  CHECK (!strcmp (entries[0].name, "b") && !entries[0].is_dir,
+         "first entry is file \"b\"");
+  CHECK (!strcmp (entries[1].name, "c") && !entries[1].is_dir,
+         "second entry is file \"c\"");
+  CHECK (!strcmp (entries[2].name, "d") && entries[2].is_dir,
+         "third entry is directory \"d\"");
+  CHECK (getdents (fd, entries, 8) == 0, "getdents \"a\" at end");
+  msg ("close \"a\"");
+  close (fd);
+}
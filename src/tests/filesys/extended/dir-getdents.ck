@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "a"
+(dir-getdents) create "a/b"
+(dir-getdents) create "a/c"
+(dir-getdents) mkdir "a/d"
+(dir-getdents) open "a"
+(dir-getdents) getdents "a" returned 3 entries
+(dir-getdents) first entry is file "b"
+(dir-getdents) second entry is file "c"
+(dir-getdents) third entry is directory "d"
+(dir-getdents) getdents "a" at end
+(dir-getdents) close "a"
+(dir-getdents) end
+EOF
+pass;
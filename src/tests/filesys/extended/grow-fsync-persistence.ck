@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (3000);
+check_archive ({"fsync-me" => [$data],
+		"fsync-dir" => {"fsync-me-too" => [substr ($data, 0, 1000)]}});
+pass;
@@ -0,0 +1,52 @@
+/* Grows a file, forces it to disk with fsync(), then appends
+   more data and forces everything out with sync().  Also creates
+   a file in a new directory and forces it to disk with fsync(),
+   and checks that fsync() fails on a closed descriptor.  The
+   kernel then powers off without syncing the file system (see
+   Make.tests), so the persistence check verifies that fsync()
+   and sync() alone made the data durable. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3000];
+
+void
+test_main (void)
+{
+  const char *file_name = "fsync-me";
+  const char *dir_name = "fsync-dir";
+  const char *sub_name = "fsync-dir/fsync-me-too";
+  int fd, dir_fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, 1000) == 1000, "write 1000 bytes to \"%s\"",
+         file_name);
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", file_name);
+  CHECK (write (fd, buf + 1000, 2000) == 2000, "write 2000 bytes to \"%s\"",
+         file_name);
+  msg ("sync");
+  sync ();
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+
+  CHECK (mkdir (dir_name), "mkdir \"%s\"", dir_name);
+  CHECK (create (sub_name, 0), "create \"%s\"", sub_name);
+  CHECK ((fd = open (sub_name)) > 1, "open \"%s\"", sub_name);
+  CHECK (write (fd, buf, 1000) == 1000, "write 1000 bytes to \"%s\"",
+         sub_name);
+  CHECK (fsync (fd) == 0, "fsync \"%s\"", sub_name);
+  msg ("close \"%s\"", sub_name);
+  close (fd);
+  CHECK ((dir_fd = open (dir_name)) > 1, "open \"%s\"", dir_name);
+  CHECK (fsync (dir_fd) == 0, "fsync \"%s\"", dir_name);
+  msg ("close \"%s\"", dir_name);
+  close (dir_fd);
+  CHECK (fsync (dir_fd) == -1, "fsync closed fd");
+}
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fsync) begin
+(grow-fsync) create "fsync-me"
+(grow-fsync) open "fsync-me"
+(grow-fsync) write 1000 bytes to "fsync-me"
+(grow-fsync) fsync "fsync-me"
+(grow-fsync) write 2000 bytes to "fsync-me"
+(grow-fsync) sync
+(grow-fsync) close "fsync-me"
+(grow-fsync) open "fsync-me" for verification
+(grow-fsync) verified contents of "fsync-me"
+(grow-fsync) close "fsync-me"
+(grow-fsync) mkdir "fsync-dir"
+(grow-fsync) create "fsync-dir/fsync-me-too"
+(grow-fsync) open "fsync-dir/fsync-me-too"
+(grow-fsync) write 1000 bytes to "fsync-dir/fsync-me-too"
+(grow-fsync) fsync "fsync-dir/fsync-me-too"
+(grow-fsync) close "fsync-dir/fsync-me-too"
+(grow-fsync) open "fsync-dir"
+(grow-fsync) fsync "fsync-dir"
+(grow-fsync) close "fsync-dir"
+(grow-fsync) fsync closed fd
+(grow-fsync) end
+EOF
+pass;
@@ -0,0 +1,19 @@
+/* Child process run by the fpu-switch test.
+   Computes 1 + 1 + 1 on a freshly initialized FPU and returns
+   the result as its exit code. */
+
+#include <stdio.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-fpu";
+
+int
+main (void)
+{
+  int x;
+
+  asm volatile ("finit; fld1; fld1; fld1; faddp; faddp; fistpl %0"
+                : "=m" (x));
+  msg ("run");
+  return x;
+}
@@ -0,0 +1,26 @@
+/* Reads the monotonic clock many times and checks that it never
+   goes backward and that it advances across a busy loop. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int64_t start = clock_ns ();
+  int64_t prev = start;
+  int i;
+
+  CHECK (start > 0, "clock_ns");
+  for (i = 0; i < 10000; i++)
+    {
+      int64_t now = clock_ns ();
+      if (now < prev)
+        fail ("clock went backward after %d reads", i);
+      prev = now;
+    }
+  if (prev <= start)
+    fail ("clock did not advance");
+  msg ("clock is monotonic");
+}
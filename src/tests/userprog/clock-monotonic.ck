@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clock-monotonic) begin
+(clock-monotonic) clock_ns
+(clock-monotonic) clock is monotonic
+(clock-monotonic) end
+clock-monotonic: exit(0)
+EOF
+pass;
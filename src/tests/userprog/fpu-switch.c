@@ -0,0 +1,20 @@
+/* Leaves a value on the FPU stack, runs a child process that
+   uses the FPU too, and checks that the value survived the
+   switches to the child and back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  int x;
+
+  /* User programs are compiled with -msoft-float, so nothing but
+     these asm statements touches the FPU. */
+  asm volatile ("fld1; fld1; faddp");
+  msg ("wait(exec()) = %d", wait (exec ("child-fpu")));
+  asm volatile ("fistpl %0" : "=m" (x));
+  CHECK (x == 2, "FPU value preserved");
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fpu-switch) begin
+(child-fpu) run
+child-fpu: exit(3)
+(fpu-switch) wait(exec()) = 3
+(fpu-switch) FPU value preserved
+(fpu-switch) end
+fpu-switch: exit(0)
+EOF
+pass;
@@ -0,0 +1,22 @@
+/* Waits for a child process, and checks that the scheduler
+   statistics show the time spent blocked in wait(). */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  struct schedstat before, after;
+
+  schedstat (&before);
+  msg ("wait(exec()) = %d", wait (exec ("child-simple")));
+  schedstat (&after);
+
+  CHECK (after.voluntary_switches > before.voluntary_switches,
+         "voluntary switches increased");
+  CHECK (after.blocked_ns > before.blocked_ns, "blocked time increased");
+  CHECK (after.max_latency_ns >= before.max_latency_ns,
+         "max latency did not decrease");
+}
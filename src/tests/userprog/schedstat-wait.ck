@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(schedstat-wait) begin
+(child-simple) run
+child-simple: exit(81)
+(schedstat-wait) wait(exec()) = 81
+(schedstat-wait) voluntary switches increased
+(schedstat-wait) blocked time increased
+(schedstat-wait) max latency did not decrease
+(schedstat-wait) end
+schedstat-wait: exit(0)
+EOF
+pass;
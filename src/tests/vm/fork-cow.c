@@ -0,0 +1,67 @@
+/* Forks a child that writes to memory it shares copy-on-write
+   with its parent, and checks that neither process sees the
+   other's writes.  The child's first write is a read() system
+   call, so that the kernel, not the child, writes to the shared
+   memory.  The child also checks that it inherited the parent's
+   FPU state, and the parent that it kept its own. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/vm/sample.inc"
+
+static char buf[2 * 4096];
+
+/* Returns true if every byte of buf is C. */
+static bool
+buf_is (char c)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != c)
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  /* Straddles the boundary between buf's two pages. */
+  char *middle = buf + sizeof buf / 2 - strlen (sample) / 2;
+  pid_t pid;
+  int status;
+  int x;
+
+  memset (buf, 'p', sizeof buf);
+
+  /* User programs are compiled with -msoft-float, so nothing but
+     these asm statements touches the FPU. */
+  asm volatile ("fld1; fld1; faddp");
+  pid = fork ();
+  if (pid == 0)
+    {
+      bool inherited, read_ok;
+      int handle;
+
+      asm volatile ("fistpl %0" : "=m" (x));
+      inherited = buf_is ('p');
+      handle = open ("sample.txt");
+      read_ok = (handle > 1
+                 && read (handle, middle, strlen (sample))
+                    == (int) strlen (sample)
+                 && !memcmp (middle, sample, strlen (sample)));
+      memset (buf, 'c', sizeof buf);
+      exit (inherited && read_ok && x == 2 ? 81 : 1);
+    }
+
+  /* Print nothing until the child is done, so that its exit
+     message comes first. */
+  status = wait (pid);
+  CHECK (pid != PID_ERROR, "fork");
+  msg ("wait(fork()) = %d", status);
+  asm volatile ("fistpl %0" : "=m" (x));
+  CHECK (x == 2, "FPU value preserved");
+  CHECK (buf_is ('p'), "parent's memory unchanged");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+fork-cow: exit(81)
+(fork-cow) fork
+(fork-cow) wait(fork()) = 81
+(fork-cow) FPU value preserved
+(fork-cow) parent's memory unchanged
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
@@ -0,0 +1,245 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+
+/* Lazy FPU context switching.
+
+   The kernel is compiled with -msoft-float, so only user
+   programs use the x87 FPU and SSE registers.  Rather than
+   saving and restoring those registers on every context switch,
+   a switch to any thread but the one whose state is in the FPU
+   (fpu_owner) sets CR0.TS, so that the thread's next FPU or SSE
+   instruction raises a #NM (device not available) exception.
+   The #NM handler saves fpu_owner's registers, loads the
+   faulting thread's, clears CR0.TS, and returns to restart the
+   instruction.  Threads that never use the FPU never take the
+   exception, and never have FPU state saved or allocated.
+
+   See [IA32-v3a] 2.5 "Control Registers" and 13.4 "Designing OS
+   Facilities for Saving x87 FPU, SSE, and Extended States on
+   Task or Context Switches". */
+
+/* CR0 and CR4 bits. */
+#define CR0_MP 0x00000002       /* Monitor coprocessor. */
+#define CR0_EM 0x00000004       /* (Floating-point) Emulation. */
+#define CR0_TS 0x00000008       /* Task switched. */
+#define CR0_NE 0x00000020       /* Native FPU error reporting. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE/FXRSTOR and SSE enabled. */
+#define CR4_OSXMMEXCPT 0x00000400 /* SSE exceptions enabled. */
+
+/* CPUID function 1 feature bits, in EDX. */
+#define CPUID_FXSR (1u << 24)   /* FXSAVE/FXRSTOR. */
+#define CPUID_SSE (1u << 25)    /* SSE. */
+
+/* Saved FPU state.  FXSAVE needs 512 bytes aligned on a 16-byte
+   boundary; FNSAVE, used without FXSR, needs only 108. */
+#define FPU_STATE_SIZE 512
+#define FPU_STATE_ALIGN 16
+
+/* Fields of an FXSAVE image that are not zero in the state a
+   thread starts with.  See [IA32-v2a] "FXSAVE". */
+#define FX_FCW_OFS 0            /* x87 control word. */
+#define FX_MXCSR_OFS 24         /* SSE control and status. */
+#define FCW_INIT 0x037f         /* x87 control word after FNINIT. */
+#define MXCSR_INIT 0x1f80       /* MXCSR at reset: all exceptions masked. */
+
+/* With FXSR, the state a thread's first FPU instruction starts
+   from: FNINIT's x87 state, MXCSR_INIT, and every x87 and XMM
+   register zeroed.  Loading it replaces all of the previous
+   owner's registers, whereas FNINIT leaves its XMM registers and
+   MXCSR, and the contents of its x87 registers, in place. */
+static uint8_t clean_state[FPU_STATE_SIZE]
+  __attribute__ ((aligned (FPU_STATE_ALIGN)));
+
+static bool have_fxsr;          /* Use FXSAVE rather than FNSAVE? */
+static bool ts_set;             /* Is CR0.TS set? */
+
+/* Thread whose state is in the FPU registers, or a null pointer
+   if the registers hold nothing of value. */
+static struct thread *fpu_owner;
+
+static intr_handler_func fpu_trap;
+
+static inline uint32_t
+read_cr0 (void)
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0)
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* Returns T's FPU save area, aligned as the save instructions
+   require. */
+static void *
+state_area (struct thread *t)
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu, FPU_STATE_ALIGN);
+}
+
+/* Enables the FPU, and SSE if the CPU has it, for use by user
+   programs, and installs the #NM handler. */
+void
+fpu_init (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  uint32_t cr4;
+
+  asm ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+  have_fxsr = (edx & CPUID_FXSR) != 0;
+  if (have_fxsr)
+    {
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR;
+      if (edx & CPUID_SSE)
+        cr4 |= CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+
+      *(uint16_t *) (clean_state + FX_FCW_OFS) = FCW_INIT;
+      *(uint32_t *) (clean_state + FX_MXCSR_OFS) = MXCSR_INIT;
+    }
+
+  /* Start with CR0.TS set: no thread has used the FPU yet. */
+  write_cr0 ((read_cr0 () & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+  ts_set = true;
+
+  intr_register_int (7, 0, INTR_ON, fpu_trap,
+                     "#NM Device Not Available Exception");
+}
+
+/* Called with interrupts off when thread T is about to run.
+   Lets T use the FPU directly if its state is still in the FPU
+   registers, and otherwise arranges for T's first FPU
+   instruction to trap. */
+void
+fpu_switch (struct thread *t)
+{
+  bool want_ts = t != fpu_owner;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (want_ts == ts_set)
+    return;
+  if (want_ts)
+    write_cr0 (read_cr0 () | CR0_TS);
+  else
+    asm volatile ("clts");
+  ts_set = want_ts;
+}
+
+/* Discards the FPU state of thread T, which is exiting. */
+void
+fpu_release (struct thread *t)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (fpu_owner == t)
+    fpu_owner = NULL;
+  intr_set_level (old_level);
+
+  free (t->fpu);
+  t->fpu = NULL;
+}
+
+/* Stores in *FPU a copy of the running thread's FPU state, to
+   become the FPU member of a process created by fork(), or a
+   null pointer if the thread has never used the FPU.  Returns
+   false if memory is not available. */
+bool
+fpu_copy (void **fpu)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  void *copy;
+
+  *fpu = NULL;
+  if (cur->fpu == NULL)
+    return true;
+  copy = malloc (FPU_STATE_SIZE + FPU_STATE_ALIGN - 1);
+  if (copy == NULL)
+    return false;
+
+  /* If our state is live in the registers, CR0.TS is clear, and
+     we can save it directly.  FNSAVE reinitializes the FPU, so
+     reload the state after it. */
+  old_level = intr_disable ();
+  if (fpu_owner == cur)
+    {
+      if (have_fxsr)
+        asm volatile ("fxsave %0" : "=m" (*(char (*)[FPU_STATE_SIZE])
+                                           state_area (cur)));
+      else
+        asm volatile ("fnsave %0; frstor %0"
+                      : "+m" (*(char (*)[FPU_STATE_SIZE])
+                              state_area (cur)));
+    }
+  memcpy ((void *) ROUND_UP ((uintptr_t) copy, FPU_STATE_ALIGN),
+          state_area (cur), FPU_STATE_SIZE);
+  intr_set_level (old_level);
+
+  *fpu = copy;
+  return true;
+}
+
+/* #NM handler: gives the FPU to the running thread. */
+static void
+fpu_trap (struct intr_frame *f UNUSED)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool fresh = false;
+
+  /* A thread's first FPU instruction: make room to save its
+     state, and start it from a clean FPU. */
+  if (cur->fpu == NULL)
+    {
+      cur->fpu = malloc (FPU_STATE_SIZE + FPU_STATE_ALIGN - 1);
+      if (cur->fpu == NULL)
+        {
+          printf ("%s: out of memory for FPU state\n", thread_name ());
+          thread_exit ();
+        }
+      fresh = true;
+    }
+
+  old_level = intr_disable ();
+  asm volatile ("clts");
+  ts_set = false;
+  if (fpu_owner != cur)
+    {
+      if (fpu_owner != NULL)
+        {
+          if (have_fxsr)
+            asm volatile ("fxsave %0" : "=m" (*(char (*)[FPU_STATE_SIZE])
+                                               state_area (fpu_owner)));
+          else
+            asm volatile ("fnsave %0" : "=m" (*(char (*)[FPU_STATE_SIZE])
+                                               state_area (fpu_owner)));
+        }
+
+      if (have_fxsr)
+        asm volatile ("fxrstor %0"
+                      : : "m" (*(char (*)[FPU_STATE_SIZE])
+                               (fresh ? clean_state : state_area (cur))));
+      else if (fresh)
+        asm volatile ("fninit");
+      else
+        asm volatile ("frstor %0" : : "m" (*(char (*)[FPU_STATE_SIZE])
+                                          state_area (cur)));
+      fpu_owner = cur;
+    }
+  intr_set_level (old_level);
+}
@@ -13,15 +13,18 @@
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
+#include "devices/tsc.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
 #include "threads/interrupt.h"
+#include "threads/fpu.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -37,6 +40,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -110,15 +117,22 @@ main (void)
   timer_init ();
   kbd_init ();
   input_init ();
+  fpu_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
 #endif
+#ifdef VM
+  page_init ();
+#endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  tsc_calibrate ();
+  workqueue_init ();
+  palloc_zero_start ();
 
 #ifdef FILESYS
   /* Initialize file system. */
@@ -126,6 +140,9 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
 
@@ -243,6 +260,8 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-crash"))
+        shutdown_configure (SHUTDOWN_CRASH);
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
@@ -256,6 +275,10 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-tickless"))
+        timer_tickless = true;
+      else if (!strcmp (name, "-mleak"))
+        malloc_track = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -371,6 +394,7 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -crash             Like -q, but without syncing the file system.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
@@ -379,6 +403,8 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -tickless          Stop the timer tick while the CPU is idle.\n"
+          "  -mleak             Report live malloc() blocks at shutdown.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -1,12 +1,15 @@
 #include "threads/malloc.h"
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <round.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
@@ -26,7 +29,28 @@
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
+   and give the arena back to the page allocator, unless the
+   descriptor has fewer than ARENA_RETAIN_MAX such unused arenas,
+   in which case we keep it so that a caller that repeatedly
+   allocates and frees one block does not get and free a page
+   each time.
+
+   Each thread also keeps a "magazine" of free blocks for each
+   descriptor.  malloc() takes a block from the running thread's
+   magazine and free() puts one back, without taking the
+   descriptor's lock.  Only when a magazine runs empty or full
+   do we take the lock, and then we move MAGAZINE_BATCH blocks
+   between the magazine and the descriptor at once.  Blocks in a
+   magazine count as in use in their arena.  A thread's
+   magazines are returned to the descriptors when it exits.
+
+   Each descriptor counts its allocations, frees, arenas, and the
+   bytes requested from it, for malloc_print_stats().  With the
+   -mleak kernel option, every allocated block is also recorded,
+   with its size and the address malloc() was called from, in a
+   hash table whose memory comes straight from the page
+   allocator, so that the blocks still allocated at shutdown can
+   be reported by call site.
 
    We can't handle blocks bigger than 2 kB using this scheme,
    because they're too big to fit in a single page with a
@@ -40,9 +64,24 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Number of arenas with no blocks in use. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics. */
+    unsigned alloc_cnt;         /* Number of blocks allocated. */
+    unsigned freed_cnt;         /* Number of blocks freed. */
+    size_t arena_cnt;           /* Number of arenas. */
+    uint64_t req_bytes;         /* Total bytes requested. */
   };
 
+/* Maximum number of unused arenas a descriptor keeps. */
+#define ARENA_RETAIN_MAX 1
+
+/* Maximum number of blocks in a magazine, and the number moved
+   between a magazine and its descriptor at a time. */
+#define MAGAZINE_SIZE 8
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -57,15 +96,56 @@ struct arena
 /* Free block. */
 struct block
   {
-    struct list_elem free_elem; /* Free list element. */
+    union
+      {
+        struct list_elem free_elem; /* Free list element. */
+        struct block *mag_next;     /* Next block in a magazine. */
+      };
   };
 
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASS_CNT]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Big block statistics. */
+static unsigned big_alloc_cnt;  /* Number of big blocks allocated. */
+static unsigned big_freed_cnt;  /* Number of big blocks freed. */
+static size_t big_page_cnt;     /* Pages in allocated big blocks. */
+
+/* Leak tracking.  If true, every allocated block is recorded in
+   the table below.  Controlled by kernel command-line option
+   "-mleak". */
+bool malloc_track;
+
+/* A tracked block. */
+struct track
+  {
+    struct track *next;         /* Next in bucket or in track_free. */
+    void *block;                /* Allocated block. */
+    void *caller;               /* Where malloc() was called from. */
+    size_t size;                /* Requested size. */
+  };
+
+#define TRACK_PAGES 16          /* Pages of struct track. */
+#define TRACK_BUCKET_CNT (PGSIZE / sizeof (struct track *))
+#define LEAK_SITES_MAX 32       /* Call sites reported at shutdown. */
+
+static struct track **track_buckets; /* Hash table of tracked blocks. */
+static struct track *track_free;     /* Unused struct tracks. */
+static unsigned track_dropped;       /* Blocks not tracked, table full. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *desc_get_block (struct desc *);
+static void desc_put_block (struct desc *, struct block *);
+static bool magazine_fill (struct desc *, struct malloc_magazine *);
+static void magazine_drain (struct desc *, struct malloc_magazine *,
+                            size_t cnt);
+static void *malloc_at (size_t, void *caller);
+static void note_alloc (struct desc *, void *block, size_t size,
+                        void *caller);
+static void note_free (struct arena *, void *block);
+static void print_leaks (void);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -80,16 +160,41 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
+      d->empty_cnt = 0;
       lock_init (&d->lock);
     }
+
+  if (malloc_track)
+    {
+      struct track *t;
+      size_t i;
+
+      track_buckets = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      t = palloc_get_multiple (PAL_ASSERT, TRACK_PAGES);
+      for (i = 0; i < TRACK_PAGES * PGSIZE / sizeof *t; i++)
+        {
+          t[i].next = track_free;
+          track_free = &t[i];
+        }
+    }
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size)
+{
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Obtains and returns a new block of at least SIZE bytes on
+   behalf of a call from CALLER.  Returns a null pointer if
+   memory is not available. */
+static void *
+malloc_at (size_t size, void *caller)
 {
   struct desc *d;
+  struct malloc_magazine *m;
   struct block *b;
   struct arena *a;
 
@@ -116,40 +221,20 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+      note_alloc (NULL, a + 1, size, caller);
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL)
-        {
-          lock_release (&d->lock);
-          return NULL;
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++)
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
-
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  /* Take a block from the running thread's magazine, refilling
+     it from the descriptor if it is empty. */
+  ASSERT (!intr_context ());
+  m = &thread_current ()->mags[d - descs];
+  if (m->cnt == 0 && !magazine_fill (d, m))
+    return NULL;
+  b = m->head;
+  m->head = b->mag_next;
+  m->cnt--;
+  note_alloc (d, b, size, caller);
   return b;
 }
 
@@ -167,7 +252,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,7 +286,7 @@ realloc (void *old_block, size_t new_size)
     }
   else
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_at (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -224,43 +309,328 @@ free (void *p)
       struct arena *a = block_to_arena (b);
       struct desc *d = a->desc;
 
+      note_free (a, b);
       if (d != NULL)
         {
           /* It's a normal block.  We handle it here. */
+          struct malloc_magazine *m;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
 
-          lock_acquire (&d->lock);
+          /* Put the block in the running thread's magazine,
+             first making room if it is full. */
+          ASSERT (!intr_context ());
+          m = &thread_current ()->mags[d - descs];
+          if (m->cnt >= MAGAZINE_SIZE)
+            magazine_drain (d, m, MAGAZINE_BATCH);
+          b->mag_next = m->head;
+          m->head = b;
+          m->cnt++;
+        }
+      else
+        {
+          /* It's a big block.  Free its pages. */
+          palloc_free_multiple (a, a->free_cnt);
+          return;
+        }
+    }
+}
+
+/* Returns the blocks in the running thread's magazines to their
+   descriptors.  Called by thread_exit() before the thread's
+   memory is freed. */
+void
+malloc_thread_exit (void)
+{
+  struct thread *t = thread_current ();
+  size_t i;
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+  for (i = 0; i < desc_cnt; i++)
+    if (t->mags[i].cnt > 0)
+      magazine_drain (&descs[i], &t->mags[i], t->mags[i].cnt);
+}
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena)
-            {
-              size_t i;
+/* Moves up to MAGAZINE_BATCH blocks from descriptor D into
+   magazine M, which must be empty.  Returns false if no block
+   could be obtained because memory is not available. */
+static bool
+magazine_fill (struct desc *d, struct malloc_magazine *m)
+{
+  size_t i;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++)
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+  ASSERT (m->cnt == 0);
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < MAGAZINE_BATCH; i++)
+    {
+      struct block *b = desc_get_block (d);
+      if (b == NULL)
+        break;
+      b->mag_next = m->head;
+      m->head = b;
+      m->cnt++;
+    }
+  lock_release (&d->lock);
+
+  return m->cnt > 0;
+}
+
+/* Moves CNT blocks from magazine M back to descriptor D. */
+static void
+magazine_drain (struct desc *d, struct malloc_magazine *m, size_t cnt)
+{
+  ASSERT (cnt <= m->cnt);
+
+  lock_acquire (&d->lock);
+  for (; cnt > 0; cnt--)
+    {
+      struct block *b = m->head;
+      m->head = b->mag_next;
+      m->cnt--;
+      desc_put_block (d, b);
+    }
+  lock_release (&d->lock);
+}
+
+/* Removes a block from descriptor D's free list and returns it,
+   creating a new arena if the free list is empty.  Returns a
+   null pointer if memory is not available.  D's lock must be
+   held. */
+static struct block *
+desc_get_block (struct desc *d)
+{
+  struct block *b;
+  struct arena *a;
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++)
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+      d->empty_cnt++;
+      d->arena_cnt++;
+    }
+
+  /* Get a block from free list. */
+  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+  a = block_to_arena (b);
+  if (a->free_cnt-- == d->blocks_per_arena)
+    d->empty_cnt--;
+  return b;
+}
+
+/* Returns block B to descriptor D's free list.  If B's arena is
+   then entirely unused, frees the arena unless D keeps it.  D's
+   lock must be held. */
+static void
+desc_put_block (struct desc *d, struct block *b)
+{
+  struct arena *a = block_to_arena (b);
+
+  ASSERT (lock_held_by_current_thread (&d->lock));
+  ASSERT (a->desc == d);
+
+  /* Add block to free list. */
+  list_push_front (&d->free_list, &b->free_elem);
+
+  /* If the arena is now entirely unused, keep it or free it. */
+  if (++a->free_cnt >= d->blocks_per_arena)
+    {
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      if (d->empty_cnt < ARENA_RETAIN_MAX)
+        d->empty_cnt++;
+      else
+        {
+          size_t i;
+
+          for (i = 0; i < d->blocks_per_arena; i++)
+            {
+              struct block *b = arena_to_block (a, i);
+              list_remove (&b->free_elem);
             }
+          palloc_free_page (a);
+          d->arena_cnt--;
+        }
+    }
+}
+
+/* Prints each size class's statistics and, if leak tracking is
+   on, the blocks still allocated. */
+void
+malloc_print_stats (void)
+{
+  size_t i;
+
+  printf ("Malloc: %6s %8s %8s %8s %6s %5s\n",
+          "size", "allocs", "frees", "live", "arenas", "waste");
+  for (i = 0; i < desc_cnt; i++)
+    {
+      struct desc *d = &descs[i];
+      uint64_t total = (uint64_t) d->alloc_cnt * d->block_size;
+      unsigned waste = (total > 0
+                        ? (total - d->req_bytes) * 100 / total
+                        : 0);
+
+      printf ("Malloc: %6zu %8u %8u %8u %6zu %4u%%\n",
+              d->block_size, d->alloc_cnt, d->freed_cnt,
+              d->alloc_cnt - d->freed_cnt, d->arena_cnt, waste);
+    }
+  printf ("Malloc: %6s %8u %8u %8u %6zu pages\n", "big",
+          big_alloc_cnt, big_freed_cnt, big_alloc_cnt - big_freed_cnt,
+          big_page_cnt);
 
-          lock_release (&d->lock);
+  if (malloc_track)
+    print_leaks ();
+}
+
+/* Returns the hash bucket that tracks BLOCK. */
+static struct track **
+track_bucket (void *block)
+{
+  return &track_buckets[hash_bytes (&block, sizeof block) % TRACK_BUCKET_CNT];
+}
+
+/* Records the allocation of BLOCK from descriptor D, or a big
+   block if D is null, for a SIZE-byte request from CALLER. */
+static void
+note_alloc (struct desc *d, void *block, size_t size, void *caller)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (d != NULL)
+    {
+      d->alloc_cnt++;
+      d->req_bytes += size;
+    }
+  else
+    {
+      big_alloc_cnt++;
+      big_page_cnt += block_to_arena (block)->free_cnt;
+    }
+
+  if (malloc_track)
+    {
+      if (track_free != NULL)
+        {
+          struct track **bucket = track_bucket (block);
+          struct track *t = track_free;
+
+          track_free = t->next;
+          t->block = block;
+          t->caller = caller;
+          t->size = size;
+          t->next = *bucket;
+          *bucket = t;
         }
       else
+        track_dropped++;
+    }
+
+  intr_set_level (old_level);
+}
+
+/* Records that BLOCK, in arena A, is being freed. */
+static void
+note_free (struct arena *a, void *block)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (a->desc != NULL)
+    a->desc->freed_cnt++;
+  else
+    {
+      big_freed_cnt++;
+      big_page_cnt -= a->free_cnt;
+    }
+
+  if (malloc_track)
+    {
+      struct track **tp;
+
+      for (tp = track_bucket (block); *tp != NULL; tp = &(*tp)->next)
+        if ((*tp)->block == block)
+          {
+            struct track *t = *tp;
+            *tp = t->next;
+            t->next = track_free;
+            track_free = t;
+            break;
+          }
+    }
+
+  intr_set_level (old_level);
+}
+
+/* Prints the tracked blocks that are still allocated, grouped by
+   the address malloc() was called from.  The addresses can be
+   turned into function names with the "backtrace" utility. */
+static void
+print_leaks (void)
+{
+  struct site
+    {
+      void *caller;
+      unsigned cnt;
+      size_t bytes;
+    }
+  sites[LEAK_SITES_MAX];
+  size_t site_cnt = 0;
+  unsigned other_cnt = 0;
+  size_t i, j;
+
+  for (i = 0; i < TRACK_BUCKET_CNT; i++)
+    {
+      struct track *t;
+
+      for (t = track_buckets[i]; t != NULL; t = t->next)
         {
-          /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          for (j = 0; j < site_cnt; j++)
+            if (sites[j].caller == t->caller)
+              break;
+          if (j == site_cnt)
+            {
+              if (site_cnt >= LEAK_SITES_MAX)
+                {
+                  other_cnt++;
+                  continue;
+                }
+              sites[site_cnt].caller = t->caller;
+              sites[site_cnt].cnt = 0;
+              sites[site_cnt].bytes = 0;
+              site_cnt++;
+            }
+          sites[j].cnt++;
+          sites[j].bytes += t->size;
         }
     }
+
+  printf ("Malloc: live blocks by call site:\n");
+  for (j = 0; j < site_cnt; j++)
+    printf ("Malloc: %8u blocks %8zu bytes from %p\n",
+            sites[j].cnt, sites[j].bytes, sites[j].caller);
+  if (other_cnt > 0)
+    printf ("Malloc: %8u blocks from other call sites\n", other_cnt);
+  if (track_dropped > 0)
+    printf ("Malloc: %8u blocks not tracked, table full\n", track_dropped);
 }
 
 /* Returns the arena that block B is inside. */
@@ -2,12 +2,30 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/* Maximum number of malloc() size classes. */
+#define MALLOC_CLASS_CNT 10
+
+/* A thread's cache of free blocks of one size class, which it
+   can allocate and free without taking the class's lock. */
+struct malloc_magazine
+  {
+    void *head;                 /* First free block, or null. */
+    size_t cnt;                 /* Number of blocks. */
+  };
+
+/* Leak tracking, controlled by kernel command-line option
+   "-mleak". */
+extern bool malloc_track;
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+void malloc_thread_exit (void);
+void malloc_print_stats (void);
 
 #endif /* threads/malloc.h */
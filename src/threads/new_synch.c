@@ -1,461 +0,0 @@
-/* This file is derived from source code for the Nachos
-   instructional operating system.  The Nachos copyright notice
-   is reproduced in full below. */
-
-/* Copyright (c) 1992-1996 The Regents of the University of California.
-   All rights reserved.
-
-   Permission to use, copy, modify, and distribute this software
-   and its documentation for any purpose, without fee, and
-   without written agreement is hereby granted, provided that the
-   above copyright notice and the following two paragraphs appear
-   in all copies of this software.
-
-   IN NO EVENT SHALL THE UNIVERSITY OF CALIFORNIA BE LIABLE TO
-   ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR
-   CONSEQUENTIAL DAMAGES ARISING OUT OF THE USE OF THIS SOFTWARE
-   AND ITS DOCUMENTATION, EVEN IF THE UNIVERSITY OF CALIFORNIA
-   HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-
-   THE UNIVERSITY OF CALIFORNIA SPECIFICALLY DISCLAIMS ANY
-   WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
-   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
-   PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
-   BASIS, AND THE UNIVERSITY OF CALIFORNIA HAS NO OBLIGATION TO
-   PROVIDE MAINTENANCE, SUPPORT, UPDATES, ENHANCEMENTS, OR
-   MODIFICATIONS.
-*/
-
-#include "threads/synch.h"
-#include <stdio.h>
-#include <string.h>
-#include "threads/interrupt.h"
-#include "threads/thread.h"
-
-/* Initializes semaphore SEMA to VALUE.  A semaphore is a
-   nonnegative integer along with two atomic operators for
-   manipulating it:
-
-   - down or "P": wait for the value to become positive, then
-     decrement it.
-
-   - up or "V": increment the value (and wake up one waiting
-     thread, if any). */
-void
-sema_init (struct semaphore *sema, unsigned value)
-{
-  ASSERT (sema != NULL);
-
-  sema->value = value;
-  list_init (&sema->waiters);
-}
-
-/* Down or "P" operation on a semaphore.  Waits for SEMA's value
-   to become positive and then atomically decrements it.
-
-   This function may sleep, so it must not be called within an
-   interrupt handler.  This function may be called with
-   interrupts disabled, but if it sleeps then the next scheduled
-   thread will probably turn interrupts back on. */
-void
-sema_down (struct semaphore *sema)
-{
-  enum intr_level old_level;
-
-  ASSERT (sema != NULL);
-  ASSERT (!intr_context ());
-
-  old_level = intr_disable ();
-  while (sema->value == 0)
-    {
-      list_push_back (&sema->waiters, &thread_current ()->elem);
-      thread_block ();
-    }
-  sema->value--;
-  intr_set_level (old_level);
-}
-
-/* Down or "P" operation on a semaphore, but only if the
-   semaphore is not already 0.  Returns true if the semaphore is
-   decremented, false otherwise.
-
-   This function may be called from an interrupt handler. */
-bool
-sema_try_down (struct semaphore *sema)
-{
-  enum intr_level old_level;
-  bool success;
-
-  ASSERT (sema != NULL);
-
-  old_level = intr_disable ();
-  if (sema->value > 0)
-    {
-      sema->value--;
-      success = true;
-    }
-  else
-    success = false;
-  intr_set_level (old_level);
-
-  return success;
-}
-
-/* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
-
-   This function may be called from an interrupt handler. */
-void
-sema_up (struct semaphore *sema)
-{
-  enum intr_level old_level;
-
-  ASSERT (sema != NULL);
-
-  old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)) {
-    struct list_elem *max_waiter_elem = list_max(&sema->waiters, priority_less, NULL);
-    list_remove(max_waiter_elem);
-    struct thread *max_waiter = list_entry(max_waiter_elem, struct thread, elem);
-    thread_unblock (max_waiter);
-  }
-  sema->value++;
-  intr_set_level (old_level);
-}
-
-static void sema_test_helper (void *sema_);
-
-/* Self-test for semaphores that makes control "ping-pong"
-   between a pair of threads.  Insert calls to printf() to see
-   what's going on. */
-void
-sema_self_test (void)
-{
-  struct semaphore sema[2];
-  int i;
-  sema_init (&sema[0], 0);
-  sema_init (&sema[1], 0);
-  thread_create ("sema-test", PRI_DEFAULT, sema_test_helper, &sema);
-  for (i = 0; i < 10; i++)
-    {
-      sema_up (&sema[0]);
-      sema_down (&sema[1]);
-    }
-}
-
-/* Thread function used by sema_self_test(). */
-static void
-sema_test_helper (void *sema_)
-{
-  struct semaphore *sema = sema_;
-  int i;
-
-  for (i = 0; i < 10; i++)
-    {
-      sema_down (&sema[0]);
-      sema_up (&sema[1]);
-    }
-}
-
-/* Initializes LOCK.  A lock can be held by at most a single
-   thread at any given time.  Our locks are not "recursive", that
-   is, it is an error for the thread currently holding a lock to
-   try to acquire that lock.
-
-   A lock is a specialization of a semaphore with an initial
-   value of 1.  The difference between a lock and such a
-   semaphore is twofold.  First, a semaphore can have a value
-   greater than 1, but a lock can only be owned by a single
-   thread at a time.  Second, a semaphore does not have an owner,
-   meaning that one thread can "down" the semaphore and then
-   another one "up" it, but with a lock the same thread must both
-   acquire and release it.  When these restrictions prove
-   onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
-void
-lock_init (struct lock *lock)
-{
-  ASSERT (lock != NULL);
-
-  lock->holder = NULL;
-  sema_init (&lock->semaphore, 1);
-  lock->priority = PRI_MIN;
-}
-
-void 
-donate_priority (struct lock *lock, struct thread *curr_t, struct list_elem *tail) {
-
-  enum intr_level old_level;
-  old_level = intr_disable();
-
-  struct thread *t = list_entry(tail, struct thread, elem);
-  if (curr_t == NULL || t == NULL || curr_t->tid < 0) {
-    intr_set_level(old_level);
-    return;
-  }
-  if (curr_t->effective_priority > t->effective_priority) {
-
-
-    t->effective_priority = curr_t->effective_priority;
-    if(tail != NULL && tail->prev == NULL && tail->next != NULL) {
-      intr_set_level(old_level);
-      return;
-    }
-    intr_set_level(old_level);
-    return donate_priority(lock, t, tail->prev);
-  } else {
-    intr_set_level(old_level);
-    return;
-  }
-}
-
-/* Acquires LOCK, sleeping until it becomes available if
-   necessary.  The lock must not already be held by the current
-   thread.
-
-   This function may sleep, so it must not be called within an
-   interrupt handler.  This function may be called with
-   interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
-void
-lock_acquire (struct lock *lock)
-{
-  ASSERT (lock != NULL);
-  ASSERT (!intr_context ());
-  ASSERT (!lock_held_by_current_thread (lock));
-
-  enum intr_level old_level;
-  old_level = intr_disable();
-
-  struct thread *holder = lock->holder;
-  struct lock *l = lock;
-  
-  struct thread *t = thread_current();
-  if(!sema_try_down(&lock->semaphore)) {
-     t->lock_to_acquire = l;
-     while(t->effective_priority >  l->priority) {
-        l->priority = t->effective_priority;
-        if (l->holder == NULL) {
-          return;
-        }
-        t = l->holder;
-        if (t->effective_priority > l->priority) {
-          break;
-        } 
-        t->effective_priority = l->priority;
-        if (t->lock_to_acquire == NULL) {
-          break;
-        } 
-        l = t->lock_to_acquire;    
-     }
-     sema_down(&lock->semaphore);  
-  }
- /* while (!lock_try_acquire(lock)) {
-
-    printf("before calling donate priority \n");
-    donate_priority(lock, thread_current(), list_tail(&(lock->donor_list)));
-    printf("before pushing back on donor list \n");
-    list_push_back(&(lock->donor_list), &thread_current() ->elem);
-    printf("before calling sema_down \n");
-    sema_down (&lock->semaphore);
-  } 
-  */
-
-//  sema_down (&lock->semaphore);
-   lock->holder = thread_current();
-   t->lock_to_acquire = NULL;
- //  lock->priority = thread_current() -> effective_priority;
- //   printf("LOCK ACQUIRE: THREAD'S LOCK LIST IS NULL? %d \n", (&thread_current()->locks==NULL));
-   list_push_front(&t->locks, &lock->elem);
-   intr_set_level(old_level);  
-}
-
-
-
-/* Tries to acquires LOCK and returns true if successful or false
-   on failure.  The lock must not already be held by the current
-   thread.
-
-   This function will not sleep, so it may be called within an
-   interrupt handler. */
-bool
-lock_try_acquire (struct lock *lock)
-{
-  bool success;
-
-  ASSERT (lock != NULL);
-  ASSERT (!lock_held_by_current_thread (lock));
-
-  success = sema_try_down (&lock->semaphore);
-  if (success) {
-    struct thread *current = thread_current();
-    lock->holder = current;
-    list_push_back(&current->locks, &lock->elem);
-    if (current->effective_priority < lock->priority) {
-      current->effective_priority = lock->priority;
-    }
-  }
-  return success;
-}
-
-bool lock_compare(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-  struct lock *s = list_entry (a, struct lock, elem);
-  struct lock *t = list_entry (b, struct lock, elem);
-  return (s->priority < t->priority);
-}
-
-bool thread_compare(const struct list_elem *a, const struct list_elem *b, void *aux UNUSED)
-{
-  struct thread *s = list_entry (a, struct thread, elem);
-  struct thread *t = list_entry (b, struct thread, elem);
-  return (s->effective_priority < t->effective_priority);
-}
-
-/* Releases LOCK, which must be owned by the current thread.
-
-   An interrupt handler cannot acquire a lock, so it does not
-   make sense to try to release a lock within an interrupt
-   handler. */
-void
-lock_release (struct lock *lock)
-{
-  ASSERT(lock != NULL);
-  ASSERT(lock_held_by_current_thread(lock));
-  enum intr_level old_level;
-  old_level = intr_disable();
-
-  lock->holder = NULL;
-  struct thread *t = thread_current();
-  int old_priority = t->effective_priority;
-  list_remove(&lock->elem); //removes lock from thread's locks list
-  sema_up(&lock->semaphore);
-  //update the current thread's priority
-  if(list_empty(&t->locks)) {
-    t->effective_priority = t->base_priority;
-  } else {
-    int new_priority = list_entry(list_max(&t->locks, lock_compare, NULL), struct lock, elem)->priority;
-    if (new_priority > t->base_priority) {
-      t->effective_priority = new_priority;
-    } else {
-      t->effective_priority = t->base_priority;
-    }
-  }
-
-  //update the released lock's priority
-  if(list_empty(&lock->semaphore.waiters)) {
-    lock->priority = 0;
-  } else {
-    lock->priority = list_entry(list_max(&lock->semaphore.waiters, thread_compare, NULL), struct thread, elem)->effective_priority;
-  }
-  intr_set_level(old_level);
-  if (old_level == INTR_ON && old_priority > t->effective_priority) {
- //   printf("enters yield \n");
-    thread_yield();
-  }
-}
-
-/* Returns true if the current thread holds LOCK, false
-   otherwise.  (Note that testing whether some other thread holds
-   a lock would be racy.) */
-bool
-lock_held_by_current_thread (const struct lock *lock)
-{
-  ASSERT (lock != NULL);
-
-  return lock->holder == thread_current ();
-}
-
-/* One semaphore in a list. */
-struct semaphore_elem
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
-
-/* Initializes condition variable COND.  A condition variable
-   allows one piece of code to signal a condition and cooperating
-   code to receive the signal and act upon it. */
-void
-cond_init (struct condition *cond)
-{
-  ASSERT (cond != NULL);
-
-  list_init (&cond->waiters);
-}
-
-/* Atomically releases LOCK and waits for COND to be signaled by
-   some other piece of code.  After COND is signaled, LOCK is
-   reacquired before returning.  LOCK must be held before calling
-   this function.
-
-   The monitor implemented by this function is "Mesa" style, not
-   "Hoare" style, that is, sending and receiving a signal are not
-   an atomic operation.  Thus, typically the caller must recheck
-   the condition after the wait completes and, if necessary, wait
-   again.
-
-   A given condition variable is associated with only a single
-   lock, but one lock may be associated with any number of
-   condition variables.  That is, there is a one-to-many mapping
-   from locks to condition variables.
-
-   This function may sleep, so it must not be called within an
-   interrupt handler.  This function may be called with
-   interrupts disabled, but interrupts will be turned back on if
-   we need to sleep. */
-void
-cond_wait (struct condition *cond, struct lock *lock)
-{
-  struct semaphore_elem waiter;
-
-  ASSERT (cond != NULL);
-  ASSERT (lock != NULL);
-  ASSERT (!intr_context ());
-  ASSERT (lock_held_by_current_thread (lock));
-
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
-  lock_release (lock);
-  sema_down (&waiter.semaphore);
-  lock_acquire (lock);
-}
-
-/* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
-
-   An interrupt handler cannot acquire a lock, so it does not
-   make sense to try to signal a condition variable within an
-   interrupt handler. */
-void
-cond_signal (struct condition *cond, struct lock *lock UNUSED)
-{
-  ASSERT (cond != NULL);
-  ASSERT (lock != NULL);
-  ASSERT (!intr_context ());
-  ASSERT (lock_held_by_current_thread (lock));
-
-  if (!list_empty (&cond->waiters))
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
-}
-
-/* Wakes up all threads, if any, waiting on COND (protected by
-   LOCK).  LOCK must be held before calling this function.
-
-   An interrupt handler cannot acquire a lock, so it does not
-   make sense to try to signal a condition variable within an
-   interrupt handler. */
-void
-cond_broadcast (struct condition *cond, struct lock *lock)
-{
-  ASSERT (cond != NULL);
-  ASSERT (lock != NULL);
-
-  while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
-}
-
-
-
@@ -2,13 +2,16 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/loader.h"
+#include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +26,76 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages are
+   grouped into blocks of 2**K pages, for "order" K, each aligned
+   to its own size relative to the start of the pool, and each
+   order has a list of its free blocks.  A request for N pages
+   takes a block of the smallest order that holds N pages,
+   splitting a larger block in halves ("buddies") if necessary,
+   and frees any pages of the block beyond the first N.  Freeing
+   a block merges it with its buddy, repeatedly, as long as the
+   buddy is free too.  Thus both allocating and freeing take time
+   logarithmic in the pool size.
+
+   A free block's list element is stored in its first page, and
+   the order of each free block is recorded in a byte per page
+   kept at the start of the pool, after the bitmap of used
+   pages.
+
+   Pool operations are short, so instead of a lock they run with
+   interrupts disabled.  That also lets thread_schedule_tail()
+   free a dying thread's page, which it must do without
+   sleeping.
+
+   Each pool also keeps up to ZEROED_MAX pages that have already
+   been cleared, so that a single-page PAL_ZERO request need not
+   clear a page itself.  A low-priority thread refills these
+   stocks when they fall below ZEROED_LOW, so clearing happens
+   while the CPU would otherwise be idle.  Pre-zeroed pages are
+   given back to the pool if a request cannot otherwise be
+   satisfied, so they never make an allocation fail. */
+
+/* Number of buddy orders.  The largest block has
+   2**(ORDER_CNT - 1) pages. */
+#define ORDER_CNT 16
+
+/* Maximum number of pre-zeroed pages in a pool, and the number
+   below which the zeroing thread starts refilling it. */
+#define ZEROED_MAX 16
+#define ZEROED_LOW (ZEROED_MAX / 2)
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *free_order;                /* Per page: 1 + order of the free
+                                           block it begins, or 0. */
+    struct list free_list[ORDER_CNT];   /* Free blocks of each order. */
+    size_t free_cnt[ORDER_CNT];         /* Length of each free_list. */
+    void *zeroed[ZEROED_MAX];           /* Pre-zeroed pages. */
+    size_t zeroed_cnt;                  /* Number of pre-zeroed pages. */
     uint8_t *base;                      /* Base of pool. */
+    const char *name;                   /* Name, for debugging. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Zeroing thread state. */
+static struct semaphore zero_sema;      /* Upped to wake the thread. */
+static bool zeroer_waiting;             /* Is it waiting on zero_sema? */
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t take_pages (struct pool *, size_t page_cnt);
+static void release_zeroed (struct pool *);
+static thread_func zero_thread NO_RETURN;
+static size_t alloc_block (struct pool *, unsigned order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static void print_pool_stats (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -73,22 +130,43 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  bool zeroed = false;
+  bool wake_zeroer = false;
+  enum intr_level old_level;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
+  old_level = intr_disable ();
+  if (page_cnt == 1 && (flags & PAL_ZERO) && pool->zeroed_cnt > 0)
+    {
+      pages = pool->zeroed[--pool->zeroed_cnt];
+      zeroed = true;
+    }
   else
-    pages = NULL;
+    {
+      page_idx = take_pages (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+        {
+          /* Give the pre-zeroed pages back and try again. */
+          release_zeroed (pool);
+          page_idx = take_pages (pool, page_cnt);
+        }
+      pages = page_idx != BITMAP_ERROR ? pool->base + PGSIZE * page_idx : NULL;
+    }
+  if (zeroer_waiting && pool->zeroed_cnt < ZEROED_LOW)
+    {
+      zeroer_waiting = false;
+      wake_zeroer = true;
+    }
+  intr_set_level (old_level);
+
+  if (wake_zeroer)
+    sema_up (&zero_sema);
 
   if (pages != NULL)
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else
@@ -119,6 +197,7 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 {
   struct pool *pool;
   size_t page_idx;
+  enum intr_level old_level;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -137,8 +216,11 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +230,280 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Starts the thread that keeps the pools stocked with pre-zeroed
+   pages.  Until it is called, PAL_ZERO pages are always cleared
+   on request. */
+void
+palloc_zero_start (void)
+{
+  sema_init (&zero_sema, 0);
+  thread_create ("pagezero", PRI_MIN, zero_thread, NULL);
+}
+
+/* Prints the free memory and fragmentation of each pool. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
+  /* We'll put the pool's used_map and free_order at its base.
+     Calculate the space needed for them and subtract it from
+     the pool's size.  (This reserves a byte of free_order for
+     each of the reserved pages too, which is harmless.) */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t meta_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  unsigned order;
+
+  if (meta_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  page_cnt -= meta_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->free_order = (uint8_t *) base + bm_size;
+  memset (p->free_order, 0, page_cnt);
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      list_init (&p->free_list[order]);
+      p->free_cnt[order] = 0;
+    }
+  p->zeroed_cnt = 0;
+  p->base = base + meta_pages * PGSIZE;
+  p->name = name;
+
+  /* Put all of the pool's pages on the free lists. */
+  free_range (p, 0, page_cnt);
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL, marks them used, and
+   returns the index of the first, or BITMAP_ERROR if POOL has no
+   free run that long.  Interrupts must be off. */
+static size_t
+take_pages (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+  unsigned order;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Find the smallest order that holds PAGE_CNT pages. */
+  for (order = 0; order < ORDER_CNT; order++)
+    if (((size_t) 1 << order) >= page_cnt)
+      break;
+  if (order >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  page_idx = alloc_block (pool, order);
+  if (page_idx != BITMAP_ERROR)
+    {
+      /* Give back the pages of the block that we don't need. */
+      free_range (pool, page_idx + page_cnt,
+                  ((size_t) 1 << order) - page_cnt);
+      ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+    }
+  return page_idx;
+}
+
+/* Returns all of POOL's pre-zeroed pages to its free lists.
+   Interrupts must be off. */
+static void
+release_zeroed (struct pool *pool)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (pool->zeroed_cnt > 0)
+    {
+      void *page = pool->zeroed[--pool->zeroed_cnt];
+      size_t page_idx = pg_no (page) - pg_no (pool->base);
+
+      bitmap_reset (pool->used_map, page_idx);
+      free_range (pool, page_idx, 1);
+    }
+}
+
+/* Zeroing thread.  Takes free pages from whichever pool is short
+   of pre-zeroed pages, clears them with interrupts on, and adds
+   them to the pool's stock.  Sleeps when every pool is fully
+   stocked or out of free pages. */
+static void
+zero_thread (void *aux UNUSED)
+{
+  /* Stay out of the way of real work under the MLFQS too. */
+  thread_set_nice (NICE_MAX);
+
+  for (;;)
+    {
+      struct pool *pools[] = {&kernel_pool, &user_pool};
+      struct pool *pool = NULL;
+      void *page = NULL;
+      enum intr_level old_level;
+      size_t i;
+
+      old_level = intr_disable ();
+      for (i = 0; i < sizeof pools / sizeof *pools && page == NULL; i++)
+        if (pools[i]->zeroed_cnt < ZEROED_MAX)
+          {
+            size_t page_idx = take_pages (pools[i], 1);
+            if (page_idx != BITMAP_ERROR)
+              {
+                pool = pools[i];
+                page = pool->base + PGSIZE * page_idx;
+              }
+          }
+      if (page == NULL)
+        zeroer_waiting = true;
+      intr_set_level (old_level);
+
+      if (page == NULL)
+        {
+          sema_down (&zero_sema);
+          continue;
+        }
+
+      memset (page, 0, PGSIZE);
+
+      old_level = intr_disable ();
+      ASSERT (pool->zeroed_cnt < ZEROED_MAX);
+      pool->zeroed[pool->zeroed_cnt++] = page;
+      intr_set_level (old_level);
+    }
+}
+
+/* Returns the list element stored in page PAGE_IDX of POOL. */
+static struct list_elem *
+page_elem (struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Adds the block of 2**ORDER pages at PAGE_IDX in POOL to
+   POOL's free lists. */
+static void
+push_block (struct pool *pool, size_t page_idx, unsigned order)
+{
+  pool->free_order[page_idx] = order + 1;
+  list_push_front (&pool->free_list[order], page_elem (pool, page_idx));
+  pool->free_cnt[order]++;
+}
+
+/* Removes the block of 2**ORDER pages at PAGE_IDX in POOL from
+   POOL's free lists. */
+static void
+remove_block (struct pool *pool, size_t page_idx, unsigned order)
+{
+  ASSERT (pool->free_order[page_idx] == order + 1);
+  pool->free_order[page_idx] = 0;
+  list_remove (page_elem (pool, page_idx));
+  pool->free_cnt[order]--;
+}
+
+/* Removes a free block of 2**ORDER pages from POOL, splitting a
+   larger block if necessary, and returns its page index, or
+   BITMAP_ERROR if there is no large enough block.  Interrupts
+   must be off. */
+static size_t
+alloc_block (struct pool *pool, unsigned order)
+{
+  size_t page_idx;
+  unsigned k;
+
+  for (k = order; k < ORDER_CNT; k++)
+    if (!list_empty (&pool->free_list[k]))
+      break;
+  if (k >= ORDER_CNT)
+    return BITMAP_ERROR;
+
+  page_idx = pg_no (list_front (&pool->free_list[k])) - pg_no (pool->base);
+  remove_block (pool, page_idx, k);
+
+  /* Split the block, freeing the upper half each time. */
+  while (k > order)
+    {
+      k--;
+      push_block (pool, page_idx + ((size_t) 1 << k), k);
+    }
+  return page_idx;
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy as long as the buddy is free.  Interrupts
+   must be off, except during initialization. */
+static void
+free_block (struct pool *pool, size_t page_idx, unsigned order)
+{
+  size_t pool_size = bitmap_size (pool->used_map);
+
+  while (order + 1 < ORDER_CNT)
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx >= pool_size || pool->free_order[buddy_idx] != order + 1)
+        break;
+      remove_block (pool, buddy_idx, order);
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages starting at PAGE_IDX in POOL, as the
+   largest aligned blocks that cover them.  Interrupts must be
+   off, except during initialization. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  while (page_cnt > 0)
+    {
+      unsigned order = 0;
+
+      while (order + 1 < ORDER_CNT
+             && page_idx % ((size_t) 2 << order) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Prints the free memory in POOL and how fragmented it is, that
+   is, what fraction of the free pages lie outside the largest
+   free block. */
+static void
+print_pool_stats (struct pool *pool)
+{
+  size_t free_cnt[ORDER_CNT];
+  size_t free_pages = 0, largest = 0, zeroed_cnt;
+  enum intr_level old_level;
+  unsigned order;
+
+  old_level = intr_disable ();
+  memcpy (free_cnt, pool->free_cnt, sizeof free_cnt);
+  zeroed_cnt = pool->zeroed_cnt;
+  intr_set_level (old_level);
+
+  printf ("%s: free blocks by order:", pool->name);
+  for (order = 0; order < ORDER_CNT; order++)
+    {
+      printf (" %zu", free_cnt[order]);
+      free_pages += free_cnt[order] << order;
+      if (free_cnt[order] > 0)
+        largest = (size_t) 1 << order;
+    }
+  printf ("\n%s: %zu of %zu pages free, largest block %zu pages, "
+          "%zu%% fragmented, %zu pre-zeroed\n",
+          pool->name, free_pages, bitmap_size (pool->used_map), largest,
+          free_pages > 0 ? 100 - largest * 100 / free_pages : 0,
+          zeroed_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
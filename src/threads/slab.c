@@ -0,0 +1,231 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Slab allocator.
+
+   A kmem_cache hands out objects of one type and size.  It gets
+   memory from the page allocator one page, called a "slab", at
+   a time.  The slab begins with a header and a stack of the
+   indexes of its free objects, followed by the objects
+   themselves.  The objects are aligned to a cache line, or to
+   the smallest power-of-2 fraction of a cache line that holds
+   one, so that no object shares a cache line with another that
+   it does not have to.
+
+   Each cache keeps its slabs on three lists: partial slabs,
+   which have both free and allocated objects and satisfy
+   allocations first; full slabs; and empty slabs.  Up to
+   EMPTY_SLABS_MAX empty slabs are kept for reuse, and any more
+   are given back to the page allocator.
+
+   A cache may have a constructor, which is run on each object
+   when its slab is created, not on each allocation.  Because
+   the free stack is kept apart from the objects, a free object
+   keeps its constructed state.
+
+   Each cache has its own lock, so allocations of different
+   types of object do not contend. */
+
+/* Assumed size of a CPU cache line. */
+#define CACHE_LINE_SIZE 64
+
+/* Maximum number of empty slabs a cache keeps. */
+#define EMPTY_SLABS_MAX 1
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab3c0d
+
+/* An object cache. */
+struct kmem_cache
+  {
+    char name[16];              /* Name, for debugging. */
+    size_t size;                /* Object size, including alignment. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t first_ofs;           /* Page offset of first object. */
+    kmem_ctor_func *ctor;       /* Constructor, or null. */
+    struct lock lock;           /* Protects the members below. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list empty;          /* Slabs with no allocated objects. */
+    size_t empty_cnt;           /* Number of slabs in EMPTY. */
+  };
+
+/* Header at the start of each slab. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of cache's lists. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects. */
+  };
+
+static struct slab *slab_create (struct kmem_cache *);
+static void *slab_object (struct slab *, size_t idx);
+
+/* Creates and returns a cache of SIZE-byte objects named NAME.
+   If CTOR is nonnull, it is called on each object when the
+   object's slab is created.  Panics if memory is not
+   available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor)
+{
+  struct kmem_cache *c;
+  size_t align;
+
+  ASSERT (name != NULL);
+  ASSERT (size > 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    PANIC ("out of memory creating \"%s\" cache", name);
+
+  align = CACHE_LINE_SIZE;
+  while (align / 2 >= size && align > sizeof (uint16_t))
+    align /= 2;
+
+  strlcpy (c->name, name, sizeof c->name);
+  c->size = ROUND_UP (size, align);
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab))
+                     / (c->size + sizeof (uint16_t));
+  c->first_ofs = ROUND_UP (sizeof (struct slab)
+                           + c->objs_per_slab * sizeof (uint16_t), align);
+  while (c->first_ofs + c->objs_per_slab * c->size > PGSIZE)
+    {
+      c->objs_per_slab--;
+      c->first_ofs = ROUND_UP (sizeof (struct slab)
+                               + c->objs_per_slab * sizeof (uint16_t), align);
+    }
+  if (c->objs_per_slab == 0)
+    PANIC ("\"%s\" objects of %zu bytes do not fit in a slab", name, size);
+
+  c->ctor = ctor;
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  list_init (&c->full);
+  list_init (&c->empty);
+  c->empty_cnt = 0;
+  return c;
+}
+
+/* Allocates and returns an object from cache C, or returns a
+   null pointer if memory is not available.  The object is in
+   the state C's constructor left it in, or the state it was in
+   when it was last freed; it is not otherwise initialized. */
+void *
+kmem_cache_alloc (struct kmem_cache *c)
+{
+  struct slab *s;
+  void *object;
+
+  ASSERT (c != NULL);
+
+  lock_acquire (&c->lock);
+  if (list_empty (&c->partial))
+    {
+      if (!list_empty (&c->empty))
+        {
+          s = list_entry (list_pop_front (&c->empty), struct slab, elem);
+          c->empty_cnt--;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  s = list_entry (list_front (&c->partial), struct slab, elem);
+  object = slab_object (s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&c->full, &s->elem);
+    }
+  lock_release (&c->lock);
+
+  return object;
+}
+
+/* Returns OBJECT, which must have been allocated from cache C,
+   to C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *object)
+{
+  struct slab *s;
+  size_t ofs;
+
+  if (object == NULL)
+    return;
+
+  s = pg_round_down (object);
+  ofs = pg_ofs (object);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (ofs >= c->first_ofs && (ofs - c->first_ofs) % c->size == 0);
+
+  lock_acquire (&c->lock);
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = (ofs - c->first_ofs) / c->size;
+  if (s->free_cnt == 1 || s->free_cnt == c->objs_per_slab)
+    {
+      /* Moves from the full list to the partial list, or from the
+         partial list to the empty list. */
+      list_remove (&s->elem);
+      if (s->free_cnt < c->objs_per_slab)
+        list_push_front (&c->partial, &s->elem);
+      else if (c->empty_cnt < EMPTY_SLABS_MAX)
+        {
+          list_push_front (&c->empty, &s->elem);
+          c->empty_cnt++;
+        }
+      else
+        palloc_free_page (s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Obtains a page for a new slab of cache C, constructs its
+   objects, and returns it, or returns a null pointer if no page
+   is available.  The new slab is not on any list. */
+static struct slab *
+slab_create (struct kmem_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_object (s, i));
+    }
+  return s;
+}
+
+/* Returns object IDX in slab S. */
+static void *
+slab_object (struct slab *s, size_t idx)
+{
+  ASSERT (idx < s->cache->objs_per_slab);
+  return (uint8_t *) s + s->cache->first_ofs + idx * s->cache->size;
+}
@@ -0,0 +1,16 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object constructor for a kmem_cache.  Puts OBJECT, fresh from
+   a new slab, into its constructed state.  Objects must be in
+   that state again when they are passed to kmem_cache_free(). */
+typedef void kmem_ctor_func (void *object);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+
+#endif /* threads/slab.h */
@@ -32,6 +32,14 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Maximum length of a chain of lock holders that a priority
+   donation is passed along.  Bounds the work done with
+   interrupts off, and breaks out of deadlock cycles. */
+#define DONATION_DEPTH_MAX 8
+
+static bool thread_priority_less (const struct list_elem *,
+                                  const struct list_elem *, void *);
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -102,7 +110,9 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.  Waiters of equal priority are woken in the
+   order they started waiting.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,10 +124,15 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters))
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_max (&sema->waiters,
+                                      thread_priority_less, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
+  thread_preempt ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -179,12 +194,41 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->priority = PRI_MIN;
+}
+
+/* Makes the current thread the holder of LOCK, which it has just
+   downed.  The threads still waiting for LOCK now donate their
+   priority to the current thread.  Interrupts must be off. */
+static void
+lock_take (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct list *waiters = &lock->semaphore.waiters;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+  lock->priority = PRI_MIN;
+  if (!list_empty (waiters))
+    lock->priority = list_entry (list_max (waiters, thread_priority_less,
+                                           NULL),
+                                 struct thread, elem)->priority;
+  list_push_back (&cur->locks, &lock->elem);
+  if (!thread_mlfqs)
+    thread_update_priority (cur);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   If LOCK is held by a lower-priority thread, the current
+   thread donates its priority to the holder, and on to the
+   holder of any lock that thread is itself waiting for, so that
+   the holders run until LOCK is released.  There is no donation
+   under the multi-level feedback queue scheduler.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +236,33 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      struct lock *l = lock;
+      int depth;
+
+      cur->lock_to_acquire = lock;
+      for (depth = 0; l != NULL && l->holder != NULL
+             && l->priority < cur->priority
+             && depth < DONATION_DEPTH_MAX; depth++)
+        {
+          l->priority = cur->priority;
+          thread_update_priority (l->holder);
+          l = l->holder->lock_to_acquire;
+        }
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->lock_to_acquire = NULL;
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -216,11 +281,17 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      enum intr_level old_level = intr_disable ();
+      lock_take (lock);
+      intr_set_level (old_level);
+    }
   return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Gives up any priority donated through LOCK, so the current
+   thread may be preempted by the thread that acquires it next.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
@@ -228,10 +299,20 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  list_remove (&lock->elem);
   lock->holder = NULL;
+  lock->priority = PRI_MIN;
+  if (!thread_mlfqs)
+    thread_update_priority (cur);
+  intr_set_level (old_level);
+
   sema_up (&lock->semaphore);
 }
 
@@ -251,8 +332,22 @@ struct semaphore_elem
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+/* Orders semaphore_elems by the priority of their waiting
+   threads. */
+static bool
+waiter_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem,
+                                               elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem,
+                                               elem);
+  return a->thread->priority < b->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +390,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
 
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,8 +398,9 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
-   LOCK must be held before calling this function.
+   this function signals the highest-priority one of them to wake
+   up from its wait.  LOCK must be held before calling this
+   function.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
@@ -317,8 +414,12 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters))
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_max (&cond->waiters,
+                                      waiter_priority_less, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -336,3 +437,13 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Orders threads on a semaphore's waiters list by priority. */
+static bool
+thread_priority_less (const struct list_elem *a_,
+                      const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+  return a->priority < b->priority;
+}
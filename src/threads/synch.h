@@ -20,8 +20,10 @@ void sema_self_test (void);
 /* Lock. */
 struct lock
   {
-    struct thread *holder;      /* Thread holding lock (for debugging). */
+    struct thread *holder;      /* Thread holding lock. */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    int priority;               /* Priority donated to holder by waiters. */
+    struct list_elem elem;      /* Element in holder's `locks' list. */
   };
 
 void lock_init (struct lock *);
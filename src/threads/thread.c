@@ -5,12 +5,15 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
+#include "devices/tsc.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "filesys/file.h"
@@ -21,9 +24,14 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running, with one FIFO queue per
+   priority level.  Bit P of ready_mask (word P / 32, bit P % 32)
+   is set if and only if ready_queues[P] is nonempty, so the
+   highest ready priority is found with a bit scan. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint32_t ready_mask[(PRI_MAX + 32) / 32];
+static int ready_cnt;           /* # of threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -51,6 +59,13 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
+/* Histogram of scheduling latency, the time a thread waits in
+   the run queue before it runs.  Bucket 0 counts waits under
+   1 us, and bucket B > 0 counts waits of 2**(B-1) us up to
+   2**B us.  The last bucket also counts all longer waits. */
+#define LATENCY_BUCKETS 24
+static unsigned latency_hist[LATENCY_BUCKETS];
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
@@ -60,6 +75,33 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* Cache of `struct wait_status's. */
+struct kmem_cache *wait_status_cache;
+
+/* Multi-level feedback queue scheduler state. */
+#define MLFQS_PRI_TICKS 4       /* # of timer ticks between priority
+                                   recomputations. */
+#define MLFQS_DECAY_HIST 16     /* # of past decay factors kept. */
+static fixed_point_t load_avg;  /* System load average. */
+
+/* The once-per-second decay of recent_cpu is applied at once only
+   to the running and ready threads.  A blocked thread's recent_cpu
+   cannot otherwise change, so the decays it misses are applied
+   when it is unblocked, using the factor of each second, which is
+   kept for the last MLFQS_DECAY_HIST seconds.  mlfqs_seconds
+   counts the seconds so far, and decay_hist[S %
+   MLFQS_DECAY_HIST] is the factor of second S. */
+static int64_t mlfqs_seconds;
+static fixed_point_t decay_hist[MLFQS_DECAY_HIST];
+
+/* Threads whose recent_cpu has changed since their priority was
+   last computed.  Only the running thread accrues CPU time and
+   only the running thread can change its nice value, so between
+   the once-per-second updates only the threads on this list, at
+   most MLFQS_PRI_TICKS of them, need their priorities
+   recomputed. */
+static struct list stale_list;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -71,6 +113,15 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static void ready_push (struct thread *);
+static void ready_remove (struct thread *);
+static void change_priority (struct thread *, int priority);
+static int ready_max_priority (void);
+static void record_latency (struct thread *, int64_t now);
+static void mlfqs_tick (struct thread *);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_catch_up (struct thread *);
+static void mlfqs_update_stale (void);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -88,11 +139,15 @@ static tid_t allocate_tid (void);
 void
 thread_init (void)
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&ready_queues[i]);
   list_init (&all_list);
+  list_init (&stale_list);
   list_init(&running_thread()->children);
 
   /* Set up a thread structure for the running thread. */
@@ -107,6 +162,9 @@ thread_init (void)
 void
 thread_start (void)
 {
+  wait_status_cache = kmem_cache_create ("wait_status",
+                                         sizeof (struct wait_status), NULL);
+
   /* Create the idle thread. */
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
@@ -136,6 +194,9 @@ thread_tick (void)
   else
     kernel_ticks++;
 
+  if (thread_mlfqs)
+    mlfqs_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -145,8 +206,33 @@ thread_tick (void)
 void
 thread_print_stats (void)
 {
+  int b;
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+
+  printf ("Scheduling latency:\n");
+  for (b = 0; b < LATENCY_BUCKETS; b++)
+    if (latency_hist[b] != 0)
+      {
+        if (b == 0)
+          printf ("  < 1 us: %u\n", latency_hist[b]);
+        else if (b == LATENCY_BUCKETS - 1)
+          printf ("  >= %u us: %u\n", 1u << (b - 1), latency_hist[b]);
+        else
+          printf ("  %u-%u us: %u\n", 1u << (b - 1), 1u << b,
+                  latency_hist[b]);
+      }
+}
+
+/* Copies the running thread's scheduler statistics into
+   STATS. */
+void
+thread_get_schedstat (struct schedstat *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = thread_current ()->stats;
+  intr_set_level (old_level);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -161,9 +247,11 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   The new thread preempts the caller if PRIORITY is higher than
+   the caller's priority.  Under the multi-level feedback queue
+   scheduler, PRIORITY is ignored and the new thread's priority
+   is computed from the nice and recent_cpu values it inherits
+   from the caller. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux)
@@ -185,7 +273,12 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
-  struct wait_status *w = malloc(sizeof(struct wait_status));
+  struct wait_status *w = kmem_cache_alloc (wait_status_cache);
+  if (w == NULL)
+    {
+      palloc_free_page (t);
+      return TID_ERROR;
+    }
   w->tid = tid;
   w->exit_code = -1;
   sema_init(&w->dead, 0);
@@ -241,22 +334,56 @@ thread_block (void)
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the
+   running thread is preempted, but only if interrupts were on
+   when this function was called (or on return from the current
+   interrupt, in an interrupt handler).  This can be important:
+   if the caller had disabled interrupts itself, it may expect
+   that it can atomically unblock a thread and update other
+   data.  Such callers should use thread_preempt() once they are
+   done. */
 void
 thread_unblock (struct thread *t)
 {
   enum intr_level old_level;
+  int64_t now;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
+  if (thread_mlfqs)
+    mlfqs_catch_up (t);
+  ready_push (t);
   t->status = THREAD_READY;
+
+  now = tsc_ns ();
+  t->stats.blocked_ns += now - t->state_since;
+  t->state_since = now;
+  intr_set_level (old_level);
+
+  if (old_level == INTR_ON || intr_context ())
+    thread_preempt ();
+}
+
+/* Yields the CPU if a thread with a higher priority than the
+   running thread is ready to run.  In an interrupt handler,
+   yields on return from the interrupt instead. */
+void
+thread_preempt (void)
+{
+  enum intr_level old_level = intr_disable ();
+  struct thread *cur = running_thread ();
+  int max = ready_max_priority ();
+  bool yield = cur == idle_thread ? max >= 0 : max > cur->priority;
   intr_set_level (old_level);
+
+  if (!yield)
+    return;
+  if (intr_context ())
+    intr_yield_on_return ();
+  else if (old_level == INTR_ON)
+    thread_yield ();
 }
 
 /* Returns the name of the running thread. */
@@ -303,6 +430,8 @@ thread_exit (void)
 #ifdef USERPROG
   process_exit ();
 #endif
+  fpu_release (thread_current ());
+  malloc_thread_exit ();
 
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
@@ -326,7 +455,7 @@ thread_yield (void)
 
   old_level = intr_disable ();
   if (cur != idle_thread)
-    list_push_back (&ready_list, &cur->elem);
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -349,49 +478,265 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY, and
+   yields if that leaves a higher-priority thread ready to run.
+   The thread keeps running at any higher priority donated to it
+   until it releases the locks that carry the donation.  Has no
+   effect under the multi-level feedback queue scheduler, which
+   computes priorities itself. */
 void
 thread_set_priority (int new_priority)
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
+}
+
+/* Recomputes T's priority as the higher of its base priority
+   and the highest priority donated through any lock it holds,
+   moving T to the matching ready queue if it is ready to run.
+   Interrupts must be off. */
+void
+thread_update_priority (struct thread *t)
+{
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->locks); e != list_end (&t->locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, elem);
+      if (lock->priority > priority)
+        priority = lock->priority;
+    }
+  change_priority (t, priority);
 }
 
-/* Returns the current thread's priority. */
+/* Returns the current thread's priority, including any donated
+   priority. */
 int
 thread_get_priority (void)
 {
   return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority, and yields if it no longer has the highest
+   priority. */
 void
-thread_set_nice (int nice UNUSED)
+thread_set_nice (int nice)
 {
-  /* Not yet implemented. */
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    mlfqs_update_priority (cur);
+  intr_set_level (old_level);
+
+  thread_preempt ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  enum intr_level old_level = intr_disable ();
+  int load_avg_100 = fix_round (fix_scale (load_avg, 100));
+  intr_set_level (old_level);
+
+  return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void)
 {
-  /* Not yet implemented. */
-  return 0;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level = intr_disable ();
+  int recent_cpu_100 = fix_round (fix_scale (cur->recent_cpu, 100));
+  intr_set_level (old_level);
+
+  return recent_cpu_100;
+}
+
+/* Recomputes T's priority from its nice and recent_cpu values,
+   moving it to the matching ready queue if it is ready to run.
+   Interrupts must be off. */
+static void
+mlfqs_update_priority (struct thread *t)
+{
+  fixed_point_t base = fix_int (PRI_MAX - t->nice * 2);
+  int priority = fix_trunc (fix_sub (base, fix_unscale (t->recent_cpu, 4)));
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+
+  change_priority (t, priority);
+}
+
+/* Returns X raised to the power N, which must not be negative. */
+static fixed_point_t
+fix_pow (fixed_point_t x, int64_t n)
+{
+  fixed_point_t result = fix_int (1);
+
+  for (; n > 0; n /= 2)
+    {
+      if (n % 2 != 0)
+        result = fix_mul (result, x);
+      x = fix_mul (x, x);
+    }
+  return result;
+}
+
+/* Applies to T's recent_cpu the once-per-second decays it has
+   missed, and recomputes its priority if there were any.  Decays
+   from before the last MLFQS_DECAY_HIST seconds are applied
+   together, as if each had used the oldest factor kept.
+   Interrupts must be off. */
+static void
+mlfqs_catch_up (struct thread *t)
+{
+  int64_t missed = mlfqs_seconds - t->decay_seconds;
+  fixed_point_t nice = fix_int (t->nice);
+  int64_t s;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (missed == 0)
+    return;
+  if (missed > MLFQS_DECAY_HIST)
+    {
+      /* N decays by factor D take recent_cpu to
+         D**N * recent_cpu + nice * (1 - D**N) / (1 - D). */
+      fixed_point_t d = decay_hist[(mlfqs_seconds + 1) % MLFQS_DECAY_HIST];
+      fixed_point_t dn = fix_pow (d, missed - MLFQS_DECAY_HIST);
+      fixed_point_t one = fix_int (1);
+
+      t->recent_cpu = fix_add (fix_mul (dn, t->recent_cpu),
+                               fix_mul (nice, fix_div (fix_sub (one, dn),
+                                                       fix_sub (one, d))));
+      missed = MLFQS_DECAY_HIST;
+    }
+  for (s = mlfqs_seconds - missed + 1; s <= mlfqs_seconds; s++)
+    t->recent_cpu = fix_add (fix_mul (decay_hist[s % MLFQS_DECAY_HIST],
+                                      t->recent_cpu), nice);
+  t->decay_seconds = mlfqs_seconds;
+  mlfqs_update_priority (t);
+}
+
+/* Updates the system load average, and the recent_cpu value and
+   priority of the running and the ready threads.  Called once per
+   second, from the timer interrupt.  Blocked threads catch up when
+   they are unblocked, so the work here is bounded by the number of
+   threads that are ready to run, not by the number that exist. */
+static void
+mlfqs_update_all (void)
+{
+  struct thread *cur = running_thread ();
+  int ready_threads = ready_cnt + (cur != idle_thread);
+  fixed_point_t twice_load;
+  int priority;
+
+  load_avg = fix_add (fix_mul (fix_frac (59, 60), load_avg),
+                      fix_scale (fix_frac (1, 60), ready_threads));
+  twice_load = fix_scale (load_avg, 2);
+  mlfqs_seconds++;
+  decay_hist[mlfqs_seconds % MLFQS_DECAY_HIST]
+    = fix_div (twice_load, fix_add (twice_load, fix_int (1)));
+
+  if (cur != idle_thread)
+    mlfqs_catch_up (cur);
+
+  /* A thread whose priority changes moves to another queue.  If
+     that queue is visited later, the thread is skipped there,
+     being up to date already. */
+  for (priority = PRI_MAX; priority >= PRI_MIN; priority--)
+    {
+      struct list *queue = &ready_queues[priority];
+      struct list_elem *e, *next;
+
+      for (e = list_begin (queue); e != list_end (queue); e = next)
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+
+          next = list_next (e);
+          if (t != idle_thread)
+            mlfqs_catch_up (t);
+        }
+    }
+
+  /* Threads that ran and then blocked in the last second. */
+  mlfqs_update_stale ();
+}
+
+/* Recomputes the priority of each thread on stale_list. */
+static void
+mlfqs_update_stale (void)
+{
+  while (!list_empty (&stale_list))
+    {
+      struct thread *t = list_entry (list_pop_front (&stale_list),
+                                     struct thread, stale_elem);
+      t->priority_stale = false;
+      mlfqs_update_priority (t);
+    }
+}
+
+/* Multi-level feedback queue scheduler bookkeeping for a timer
+   tick during which CUR was running.  Runs in an external
+   interrupt context. */
+static void
+mlfqs_tick (struct thread *cur)
+{
+  int64_t ticks = timer_ticks ();
+
+  if (cur != idle_thread)
+    {
+      cur->recent_cpu = fix_add (cur->recent_cpu, fix_int (1));
+      if (!cur->priority_stale)
+        {
+          cur->priority_stale = true;
+          list_push_back (&stale_list, &cur->stale_elem);
+        }
+    }
+
+  if (ticks % TIMER_FREQ == 0)
+    mlfqs_update_all ();
+  else if (ticks % MLFQS_PRI_TICKS == 0)
+    mlfqs_update_stale ();
+  else
+    return;
+
+  thread_preempt ();
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -416,6 +761,10 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* With nothing to run until the next interrupt, there is
+         no need for timer ticks in the meantime. */
+      timer_idle_enter ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -469,24 +818,46 @@ is_thread (struct thread *t)
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
+  struct thread *parent = running_thread ();
+  int nice = NICE_DEFAULT;
+  fixed_point_t recent_cpu = fix_int (0);
   enum intr_level old_level;
 
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
 
+  /* Under the multi-level feedback queue scheduler, a new thread
+     inherits its creator's nice and recent_cpu values. */
+  if (t != parent && is_thread (parent))
+    {
+      nice = parent->nice;
+      recent_cpu = parent->recent_cpu;
+    }
+
   memset (t, 0, sizeof *t);
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  t->nice = nice;
+  t->recent_cpu = recent_cpu;
+  t->decay_seconds = mlfqs_seconds;
+  t->state_since = tsc_ns ();
   t->magic = THREAD_MAGIC;
+  list_init (&t->locks);
   list_init (&t->files);
   t->next_fd = 2;
   t->exec_file = NULL;
   list_init(&t->children);
+#ifdef VM
+  list_init (&t->mappings);
+  t->next_mapid = 0;
+#endif
 
   old_level = intr_disable ();
+  if (thread_mlfqs)
+    mlfqs_update_priority (t);
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
@@ -504,18 +875,116 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
+/* Adds T to the back of the ready queue for its priority.
+   Interrupts must be off. */
+static void
+ready_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_push_back (&ready_queues[t->priority], &t->elem);
+  ready_mask[t->priority / 32] |= 1u << (t->priority % 32);
+  ready_cnt++;
+}
+
+/* Removes ready thread T from its ready queue.  Interrupts must
+   be off. */
+static void
+ready_remove (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  list_remove (&t->elem);
+  if (list_empty (&ready_queues[t->priority]))
+    ready_mask[t->priority / 32] &= ~(1u << (t->priority % 32));
+  ready_cnt--;
+}
+
+/* Sets T's priority to PRIORITY, moving T to the matching ready
+   queue if it is ready to run.  Interrupts must be off. */
+static void
+change_priority (struct thread *t, int priority)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (priority == t->priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      ready_remove (t);
+      t->priority = priority;
+      ready_push (t);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready.  Interrupts must be off. */
+static int
+ready_max_priority (void)
+{
+  int word;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (word = (PRI_MAX + 32) / 32 - 1; word >= 0; word--)
+    if (ready_mask[word] != 0)
+      return word * 32 + (31 - __builtin_clz (ready_mask[word]));
+  return -1;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.
+
+   Returns the thread at the front of the highest-priority
+   nonempty queue, so threads of equal priority round-robin. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
+  int priority = ready_max_priority ();
+  struct list *queue;
+  struct thread *t;
+
+  if (priority < 0)
     return idle_thread;
-  else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+
+  queue = &ready_queues[priority];
+  t = list_entry (list_pop_front (queue), struct thread, elem);
+  if (list_empty (queue))
+    ready_mask[priority / 32] &= ~(1u << (priority % 32));
+  ready_cnt--;
+  return t;
+}
+
+/* Records in T's statistics and in latency_hist the time T
+   waited in the run queue, as T is about to run at time NOW.
+   Interrupts must be off. */
+static void
+record_latency (struct thread *t, int64_t now)
+{
+  int64_t wait = now - t->state_since;
+  int64_t us = wait / 1000;
+  int b = 0;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->state_since = now;
+  if (t == idle_thread)
+    return;
+
+  t->stats.ready_ns += wait;
+  if (wait > t->stats.max_latency_ns)
+    t->stats.max_latency_ns = wait;
+
+  if (us > 0)
+    b = (us >= 1 << (LATENCY_BUCKETS - 2)
+         ? LATENCY_BUCKETS - 1 : 32 - __builtin_clz ((unsigned) us));
+  latency_hist[b]++;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -547,6 +1016,10 @@ thread_schedule_tail (struct thread *prev)
   /* Start new time slice. */
   thread_ticks = 0;
 
+  /* Trap the new thread's first FPU instruction, unless its FPU
+     state is already loaded. */
+  fpu_switch (cur);
+
 #ifdef USERPROG
   /* Activate the new address space. */
   process_activate ();
@@ -557,11 +1030,15 @@ thread_schedule_tail (struct thread *prev)
      pull out the rug under itself.  (We don't free
      initial_thread because its memory was not obtained via
      palloc().) */
-  if (prev != NULL && prev->status == THREAD_DYING 
-      && prev != initial_thread)
+  if (prev != NULL && prev->status == THREAD_DYING)
     {
-      ASSERT (prev != cur);
-      palloc_free_page (prev);
+      if (prev->priority_stale)
+        list_remove (&prev->stale_elem);
+      if (prev != initial_thread)
+        {
+          ASSERT (prev != cur);
+          palloc_free_page (prev);
+        }
     }
 }
 
@@ -583,8 +1060,19 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (next != idle_thread)
+    timer_idle_exit ();
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      int64_t now = tsc_ns ();
+      if (cur->status == THREAD_READY)
+        cur->stats.involuntary_switches++;
+      else
+        cur->stats.voluntary_switches++;
+      cur->state_since = now;
+      record_latency (next, now);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
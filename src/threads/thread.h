@@ -2,10 +2,14 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
+#include <schedstat.h>
 #include <stdint.h>
 #include "threads/synch.h"
 #include "threads/fixed-point.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/file.h"
 
 /* States in a thread's life cycle. */
@@ -27,6 +31,12 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread nice values, used by the multi-level feedback queue
+   scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default nice value. */
+#define NICE_MAX 20                     /* Least nice to other threads. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -95,6 +105,7 @@ struct wait_status
     struct thread *thread;
     bool wait_called; /* boolean identifying whether wait was 
                       called on the child thread already */
+    uint32_t *pagedir; /* Page directory left for finish_exit() to free. */
 
     //exec stuff
     const char* file_name; //Program to load
@@ -109,8 +120,17 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
+    int base_priority;                  /* Priority before donations. */
+    int nice;                           /* Nice value (MLFQS). */
+    fixed_point_t recent_cpu;           /* Recent CPU time used (MLFQS). */
+    int64_t decay_seconds;              /* Decays in recent_cpu (MLFQS). */
+    bool priority_stale;                /* On stale_list? (MLFQS). */
+    struct list_elem stale_elem;        /* List element for stale_list. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct schedstat stats;             /* Scheduler statistics. */
+    int64_t state_since;                /* tsc_ns() at last status change. */
+    void *fpu;                          /* Saved FPU state (threads/fpu.c). */
     struct list files;                  /* List of file objects. */
     int next_fd;                        /* Most recent fd assigned. */
     struct file *exec_file;             /* Executable file. */
@@ -121,15 +141,32 @@ struct thread
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
+    struct list locks;                  /* Locks held, for donation. */
+    struct lock *lock_to_acquire;       /* Lock being waited for. */
+
+    /* Owned by threads/malloc.c. */
+    struct malloc_magazine mags[MALLOC_CLASS_CNT]; /* Free blocks. */
+
+    /* Owned by devices/timer.c. */
+    int64_t wake_tick;                  /* Tick to wake up at, if asleep. */
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
 #endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+
+    /* Owned by vm/mmap.c. */
+    struct list mappings;               /* Memory-mapped files. */
+    int next_mapid;                     /* Next mapping identifier. */
+#endif
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
     struct inode *cwd;
+    int journal_depth;                  /* Nesting depth of journal handles. */
   };
 
 /* A struct to store fd values of files. */
@@ -145,17 +182,22 @@ struct file_object
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* Cache of `struct wait_status's. */
+extern struct kmem_cache *wait_status_cache;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+void thread_get_schedstat (struct schedstat *);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_preempt (void);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -170,6 +212,7 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -0,0 +1,174 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Kernel worker pool.
+
+   A fixed set of worker threads runs deferred work submitted
+   with workqueue_submit(), so that kernel code does not need a
+   thread of its own, with its page and TID, for each piece of
+   background work.
+
+   Each worker has its own deque of pending work.  A submission
+   goes to the back of one worker's deque, chosen round-robin; a
+   worker takes work from the front of its own deque and, when
+   that is empty, steals from the back of the busiest other
+   worker's deque.  Work items come from a fixed pool, so the
+   memory used by pending work is bounded; when the pool is
+   exhausted, workqueue_submit() fails and the caller does the
+   work itself.
+
+   The deques and the free pool are only touched with interrupts
+   off, so work may be submitted from an interrupt handler. */
+
+#define WORKER_CNT 2            /* Number of worker threads. */
+#define WORK_CNT 64             /* Number of work items in the pool. */
+
+/* A pending piece of work. */
+struct work
+  {
+    struct list_elem elem;      /* Element in a deque or free_list. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* Argument to FUNC. */
+  };
+
+/* A worker thread and its deque of pending work. */
+struct worker
+  {
+    struct list deque;          /* Pending work. */
+    int cnt;                    /* Number of items in DEQUE. */
+  };
+
+static struct work works[WORK_CNT];
+static struct list free_list;   /* Unused members of works[]. */
+static struct worker workers[WORKER_CNT];
+static int next_worker;         /* Next worker to submit to. */
+static bool started;            /* Have the workers been started? */
+
+/* Number of items pending in all the deques together.  A worker
+   "down"s it before taking an item, so that it sleeps while
+   there is no work at all. */
+static struct semaphore pending;
+
+static thread_func worker_thread;
+static struct work *take_work (struct worker *);
+
+/* Initializes the worker pool and starts its threads. */
+void
+workqueue_init (void)
+{
+  int i;
+
+  list_init (&free_list);
+  for (i = 0; i < WORK_CNT; i++)
+    list_push_back (&free_list, &works[i].elem);
+  sema_init (&pending, 0);
+
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+
+      list_init (&workers[i].deque);
+      workers[i].cnt = 0;
+      snprintf (name, sizeof name, "worker%d", i);
+      if (thread_create (name, PRI_DEFAULT, worker_thread,
+                         &workers[i]) == TID_ERROR)
+        PANIC ("couldn't start kernel worker %d", i);
+    }
+  started = true;
+}
+
+/* Arranges for FUNC to be called with AUX by a kernel worker
+   thread, and returns true.  Returns false, without arranging
+   anything, if the worker pool is not running or too much work
+   is already pending; the caller should then call FUNC itself.
+
+   May be called from an interrupt handler. */
+bool
+workqueue_submit (work_func *func, void *aux)
+{
+  struct worker *w;
+  struct work *work;
+  enum intr_level old_level;
+
+  ASSERT (func != NULL);
+
+  if (!started)
+    return false;
+
+  old_level = intr_disable ();
+  if (list_empty (&free_list))
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  work = list_entry (list_pop_front (&free_list), struct work, elem);
+  work->func = func;
+  work->aux = aux;
+
+  w = &workers[next_worker];
+  next_worker = (next_worker + 1) % WORKER_CNT;
+  list_push_back (&w->deque, &work->elem);
+  w->cnt++;
+  intr_set_level (old_level);
+
+  sema_up (&pending);
+  return true;
+}
+
+/* Body of worker thread W_: runs pending work forever. */
+static void
+worker_thread (void *w_)
+{
+  struct worker *w = w_;
+
+  for (;;)
+    {
+      struct work *work;
+      work_func *func;
+      void *aux;
+      enum intr_level old_level;
+
+      sema_down (&pending);
+
+      old_level = intr_disable ();
+      work = take_work (w);
+      func = work->func;
+      aux = work->aux;
+      list_push_front (&free_list, &work->elem);
+      intr_set_level (old_level);
+
+      func (aux);
+    }
+}
+
+/* Removes and returns a pending work item for worker W: the
+   front of W's own deque if it is nonempty, otherwise the back
+   of the busiest other worker's deque.  There must be at least
+   one pending item.  Interrupts must be off. */
+static struct work *
+take_work (struct worker *w)
+{
+  struct worker *victim = w;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (w->cnt > 0)
+    {
+      w->cnt--;
+      return list_entry (list_pop_front (&w->deque), struct work, elem);
+    }
+
+  for (i = 0; i < WORKER_CNT; i++)
+    if (workers[i].cnt > victim->cnt)
+      victim = &workers[i];
+  ASSERT (victim->cnt > 0);
+
+  victim->cnt--;
+  return list_entry (list_pop_back (&victim->deque), struct work, elem);
+}
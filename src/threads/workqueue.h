@@ -0,0 +1,13 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <stdbool.h>
+
+/* A piece of deferred work: a function to call with AUX in a
+   kernel worker thread. */
+typedef void work_func (void *aux);
+
+void workqueue_init (void);
+bool workqueue_submit (work_func *, void *aux);
+
+#endif /* threads/workqueue.h */
@@ -214,6 +214,23 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD.  Clearing it write-protects the page, so that the
+   next write to it faults. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      invalidate_pagedir (pd);
+    }
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
@@ -7,11 +7,13 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
+#include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/palloc.h"
@@ -19,10 +21,20 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/workqueue.h"
 #include "lib/kernel/list.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static work_func finish_exit;
+#ifdef VM
+static thread_func fork_process NO_RETURN;
+static bool copy_process (struct thread *parent);
+#endif
 
 /* Looks through the current thread's list of children and returns
 the wait_status of the child with given tid, if that tid is in the
@@ -170,6 +182,126 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Information passed from a process calling fork() to the child
+   process it creates. */
+struct fork_info
+  {
+    struct thread *parent;      /* Process calling fork(). */
+    struct intr_frame if_;      /* Its user registers. */
+    void *fpu;                  /* Copy of its FPU state. */
+    struct semaphore done;      /* Up'd when the child is set up. */
+    bool success;               /* Was the child set up? */
+  };
+
+/* Creates a child of the current process, which is in a system
+   call with user registers F, that is a copy of it: the child
+   has the same memory, shared copy-on-write, the same open
+   files, and the same registers, except that fork() returns 0
+   in the child.  Memory-mapped files are not inherited.
+   Returns the child's thread id, or TID_ERROR if the child
+   cannot be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *f;
+  if (!fpu_copy (&info.fpu))
+    return TID_ERROR;
+  sema_init (&info.done, 0);
+  info.success = false;
+
+  tid = thread_create (thread_name (), PRI_DEFAULT, fork_process, &info);
+  if (tid == TID_ERROR)
+    {
+      free (info.fpu);
+      return TID_ERROR;
+    }
+  sema_down (&info.done);
+  return info.success ? tid : TID_ERROR;
+}
+
+/* A thread function that copies the process that called fork()
+   and starts the copy running. */
+static void
+fork_process (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+  bool success;
+
+  cur->fpu = info->fpu;
+  if_ = info->if_;
+  if_.eax = 0;
+  success = copy_process (info->parent);
+
+  /* INFO is gone once the parent wakes up. */
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives the current thread a copy of the address space and open
+   files of PARENT, which is blocked in fork().  Returns true if
+   successful, false on failure, in which case process_exit()
+   frees whatever was copied. */
+static bool
+copy_process (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL)
+    return false;
+  if (!page_table_init (&cur->pages))
+    {
+      pagedir_destroy (cur->pagedir);
+      cur->pagedir = NULL;
+      return false;
+    }
+  process_activate ();
+
+  cur->exec_file = file_reopen (parent->exec_file);
+  if (cur->exec_file == NULL)
+    return false;
+  file_deny_write (cur->exec_file);
+  if (!page_table_copy (parent))
+    return false;
+
+  /* Each open file is reopened at the same position, so the
+     child's position moves independently of the parent's. */
+  for (e = list_begin (&parent->files); e != list_end (&parent->files);
+       e = list_next (e))
+    {
+      struct file_object *pf = list_entry (e, struct file_object, elem);
+      struct file_object *file_obj = kmem_cache_alloc (file_object_cache);
+
+      if (file_obj == NULL)
+        return false;
+      file_obj->file_ptr = file_reopen (pf->file_ptr);
+      if (file_obj->file_ptr == NULL)
+        {
+          kmem_cache_free (file_object_cache, file_obj);
+          return false;
+        }
+      file_seek (file_obj->file_ptr, file_tell (pf->file_ptr));
+      file_obj->fd = pf->fd;
+      list_push_back (&cur->files, &file_obj->elem);
+    }
+  cur->next_fd = parent->next_fd;
+  return true;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -191,7 +323,7 @@ process_wait (tid_t child_tid UNUSED)
     sema_down(&child->dead);
     int exit_code = child->exit_code;
     list_remove(&child->elem);
-    free(child);
+    kmem_cache_free (wait_status_cache, child);
     return exit_code;
   }
 }
@@ -202,30 +334,41 @@ process_exit (void)
 {
   struct thread *cur = thread_current ();
   uint32_t *pd;
-  file_close (cur->exec_file);
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL)
     {
+#ifdef VM
+      mmap_unmap_all ();
+      page_table_destroy (&cur->pages);
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
          process page directory.  We must activate the base page
          directory before destroying the process's page
          directory, or our active page directory will be one
-         that's been freed (and cleared). */
+         that's been freed (and cleared).  Nothing else refers
+         to the page directory after that; finish_exit() frees
+         it below. */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
-      pagedir_destroy (pd);
     }
 
+  /* Close the executable only after its pages are gone, since
+     shared pages are looked up by inode and the inode must not
+     be freed and reused while they exist. */
+  file_close (cur->exec_file);
+
   /* frees all the children of the current thread */
   while (!list_empty (&cur->children))
     {
       struct list_elem *child = list_pop_front (&cur->children);
-      free (list_entry (child, struct wait_status, elem));
+      kmem_cache_free (wait_status_cache,
+                       list_entry (child, struct wait_status, elem));
     }
   
   /* frees all the files of the current thread */
@@ -234,11 +377,30 @@ process_exit (void)
       struct list_elem *e = list_pop_front (&cur->files);
       struct file_object *f = list_entry (e, struct file_object, elem);
       file_close (f->file_ptr);
-      free (f);
+      kmem_cache_free (file_object_cache, f);
   }
 
-  sema_up(&cur->wait_status->dead);
   sema_up(&cur->wait_status->load_done);
+
+  /* A kernel worker frees the page directory and only then wakes
+     up a waiting parent, so that we need not wait for the pages
+     to be freed, yet wait() does not return before they are. */
+  cur->wait_status->pagedir = pd;
+  if (!workqueue_submit (finish_exit, cur->wait_status))
+    finish_exit (cur->wait_status);
+}
+
+/* Frees the page directory of the process whose wait status is
+   W_, then signals that the process is dead.  Called on behalf
+   of process_exit(). */
+static void
+finish_exit (void *w_)
+{
+  struct wait_status *w = w_;
+
+  if (w->pagedir != NULL)
+    pagedir_destroy (w->pagedir);
+  sema_up (&w->dead);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -344,6 +506,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL)
     goto done;
+#ifdef VM
+  if (!page_table_init (&t->pages))
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -446,7 +616,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 }
 
 /* load() helpers. */
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -505,6 +677,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory, the pages are only recorded in the
+   supplemental page table here, and page_in() reads or zeroes
+   each of them when the process first accesses it.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -524,6 +700,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record the page, to be brought in on first access. */
+      if (!page_add_file (upage, file, ofs, page_read_bytes, writable))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -543,6 +725,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false;
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -557,21 +740,30 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp)
 {
-  uint8_t *kpage;
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
 
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+#ifdef VM
+  /* Give the stack page a frame right away, since we are about
+     to push the arguments onto it. */
+  success = page_add_zero (upage, true) && page_in (upage);
+  if (success)
+    *esp = PHYS_BASE;
+#else
+  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL)
     {
-      success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
+      success = install_page (upage, kpage, true);
       if (success)
         *esp = PHYS_BASE;
       else
         palloc_free_page (kpage);
     }
+#endif
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -591,3 +783,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
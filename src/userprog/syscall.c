@@ -1,5 +1,6 @@
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include <dirent.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include <string.h>
@@ -16,20 +17,33 @@
 #include "filesys/directory.h"
 #include "userprog/process.h"
 #include "devices/shutdown.h"
+#include "devices/tsc.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 bool valid_address (void *address);
 void validate_pointer (void *ptr, size_t size);
 void validate_string (char *str);
 struct file_object * get_file (int fd);
+#ifdef VM
+static void pin_buffer (void *buffer, size_t size, bool write);
+static void unpin_buffer (void *buffer, size_t size);
+#endif
 
 /* Global lock to avoid concurrent filesystem function calls. */
 struct lock filesys_lock;
 
+struct kmem_cache *file_object_cache;
+
 void
 syscall_init (void)
 {
   lock_init (&filesys_lock);
+  file_object_cache = kmem_cache_create ("file_object",
+                                         sizeof (struct file_object), NULL);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -37,20 +51,24 @@ static void
 syscall_handler (struct intr_frame *f UNUSED)
 {
   uint32_t *args = ((uint32_t *) f->esp);
+  void *buffer UNUSED = NULL;   /* User memory the call accesses. */
+  size_t size UNUSED = 0;       /* Size of BUFFER in bytes. */
+  bool writes UNUSED = false;   /* Does the kernel write BUFFER? */
   validate_pointer (args, sizeof (uint32_t));
 
   /* Conditions to check for the validity of the arguments
   passed into each call to SYS_CALL*/
-  if (args[0] != SYS_HALT)
+  if (args[0] != SYS_HALT && args[0] != SYS_SYNC && args[0] != SYS_FORK)
   {
   	validate_pointer (&args[1], sizeof (uint32_t));
   }
   if (args[0] == SYS_CREATE || args[0] == SYS_READ || args[0] == SYS_WRITE 
-      || args[0] == SYS_SEEK || args[0] == SYS_READDIR)
+      || args[0] == SYS_SEEK || args[0] == SYS_READDIR
+      || args[0] == SYS_GETDENTS || args[0] == SYS_MMAP)
   {
     validate_pointer (&args[2], sizeof (uint32_t));
   }
-  if (args[0] == SYS_READ || args[0] == SYS_WRITE)
+  if (args[0] == SYS_READ || args[0] == SYS_WRITE || args[0] == SYS_GETDENTS)
   {
     validate_pointer (&args[3], sizeof (uint32_t));
   }
@@ -59,16 +77,60 @@ syscall_handler (struct intr_frame *f UNUSED)
       || args[0] == SYS_OPEN || args[0] == SYS_MKDIR || args[0] == SYS_CHDIR)
   {
   	validate_string ((char *) args[1]);
+    buffer = (void *) args[1];
+    size = strlen (buffer) + 1;
   }
   else if (args[0] == SYS_READ || args[0] == SYS_WRITE)
   {
   	validate_pointer ((void *) args[2], args[3]);
+    buffer = (void *) args[2];
+    size = args[3];
+    writes = args[0] == SYS_READ;
   }
   else if (args[0] == SYS_READDIR)
   {
     validate_pointer ((void *) args[2], (NAME_MAX + 1) * sizeof (char));
+    buffer = (void *) args[2];
+    size = (NAME_MAX + 1) * sizeof (char);
+    writes = true;
+  }
+  else if (args[0] == SYS_GETDENTS)
+  {
+    /* A count this large would wrap the buffer size around. */
+    if (args[3] > SIZE_MAX / sizeof (struct dirent))
+    {
+      printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
+      thread_exit ();
+    }
+    validate_pointer ((void *) args[2], args[3] * sizeof (struct dirent));
+    buffer = (void *) args[2];
+    size = args[3] * sizeof (struct dirent);
+    writes = true;
+  }
+  else if (args[0] == SYS_CLOCK)
+  {
+    validate_pointer ((void *) args[1], sizeof (int64_t));
+    buffer = (void *) args[1];
+    size = sizeof (int64_t);
+    writes = true;
+  }
+  else if (args[0] == SYS_SCHEDSTAT)
+  {
+    validate_pointer ((void *) args[1], sizeof (struct schedstat));
+    buffer = (void *) args[1];
+    size = sizeof (struct schedstat);
+    writes = true;
   }
 
+#ifdef VM
+  /* Keep the buffer in memory until the call is done, so that the
+     kernel does not fault on it while holding file system locks.
+     Such a fault could copy a page shared copy-on-write, or evict
+     a memory-mapped page and write it back to a file whose lock
+     is already held. */
+  pin_buffer (buffer, size, writes);
+#endif
+
   /* Conditions to handle Process System Calls */ 
   if (args[0] == SYS_EXIT)
   {
@@ -88,6 +150,15 @@ syscall_handler (struct intr_frame *f UNUSED)
   {
     f->eax = process_wait((char *) args[1]);
   }
+  else if (args[0] == SYS_FORK)
+  {
+#ifdef VM
+    f->eax = process_fork (f);
+#else
+    /* Copy-on-write needs the supplemental page table. */
+    f->eax = -1;
+#endif
+  }
   else if (args[0] == SYS_PRACTICE)
   {
   	f->eax = args[1] + 1;
@@ -112,14 +183,17 @@ syscall_handler (struct intr_frame *f UNUSED)
     struct file *new_file = filesys_open ((char *) args[1]);
     //lock_release (&filesys_lock);
 
-    if (!new_file)
+    struct file_object *file_obj = NULL;
+    if (new_file)
+      file_obj = kmem_cache_alloc (file_object_cache);
+    if (!file_obj)
     {
+      file_close (new_file);
       f->eax = -1;
     }
     else
     {
       struct thread *t = thread_current ();
-      struct file_object *file_obj = malloc (sizeof (struct file_object));
       file_obj->file_ptr = new_file;
       file_obj->fd = t->next_fd;
       f->eax = t->next_fd;
@@ -154,6 +228,28 @@ syscall_handler (struct intr_frame *f UNUSED)
   {
     f->eax = filesys_create ((char *) args[1], 0, true);
   }
+  else if (args[0] == SYS_SYNC)
+  {
+    filesys_sync ();
+  }
+
+  /* Conditions to handle Timing System Calls */
+  else if (args[0] == SYS_CLOCK)
+  {
+    *(int64_t *) args[1] = tsc_ns ();
+  }
+  else if (args[0] == SYS_SCHEDSTAT)
+  {
+    thread_get_schedstat ((struct schedstat *) args[1]);
+  }
+
+#ifdef VM
+  /* Conditions to handle Memory Mapping System Calls */
+  else if (args[0] == SYS_MUNMAP)
+  {
+    mmap_unmap (args[1]);
+  }
+#endif
   else
   {
   	struct file_object *file_obj = get_file (args[1]);
@@ -193,7 +289,7 @@ syscall_handler (struct intr_frame *f UNUSED)
   	{
   	  file_close (file_obj->file_ptr);
   	  list_remove (&file_obj->elem);
-  	  free (file_obj);
+  	  kmem_cache_free (file_object_cache, file_obj);
     }
     else if (args[0] == SYS_INUMBER)
     {
@@ -204,27 +300,62 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = dir_readdir ((struct dir *) file_obj->file_ptr,
                             (char *) args[2]);
     }
+    else if (args[0] == SYS_GETDENTS)
+    {
+      if (file_is_directory (file_obj->file_ptr))
+        f->eax = dir_getdents ((struct dir *) file_obj->file_ptr,
+                               (struct dirent *) args[2], args[3]);
+      else
+        f->eax = -1;
+    }
+    else if (args[0] == SYS_FSYNC)
+    {
+      file_sync (file_obj->file_ptr);
+      f->eax = 0;
+    }
     else if (args[0] == SYS_ISDIR)
     {
       f->eax = file_is_directory (file_obj->file_ptr);
     }
+#ifdef VM
+    else if (args[0] == SYS_MMAP)
+    {
+      if (file_is_directory (file_obj->file_ptr))
+        f->eax = MAP_FAILED;
+      else
+        f->eax = mmap_map (file_obj->file_ptr, (void *) args[2]);
+    }
+#endif
     //lock_release (&filesys_lock);
   }
+
+#ifdef VM
+  unpin_buffer (buffer, size);
+#endif
 }
 
 /* Checks whether inputted address is a valid address in
 the user space */
 bool valid_address (void *address)
 {
-  return is_user_vaddr (address) &&
-         pagedir_get_page (thread_current ()->pagedir, address) != NULL;
+  if (!is_user_vaddr (address))
+    return false;
+  if (pagedir_get_page (thread_current ()->pagedir, address) != NULL)
+    return true;
+#ifdef VM
+  /* Bring the page in now if it has not been touched yet. */
+  return page_in (address);
+#else
+  return false;
+#endif
 }
 
 /* Checks whether inputted address is a valid pointer in
 the user space */
 void validate_pointer (void *ptr, size_t size)
 {
-  if (!valid_address (ptr) || !valid_address (ptr + size))
+  if (!valid_address (ptr) || (uintptr_t) ptr + size < (uintptr_t) ptr
+      || !valid_address (ptr + size))
   {
   	printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
   	thread_exit ();
@@ -235,7 +366,7 @@ void validate_pointer (void *ptr, size_t size)
 the user space */
 void validate_string (char *str)
 {
-  if (is_user_vaddr (str))
+  if (valid_address (str))
   {
     char *kernel_str = pagedir_get_page (thread_current ()->pagedir, str);
     if (kernel_str != NULL && valid_address (str + strlen (kernel_str) + 1))
@@ -263,3 +394,39 @@ struct file_object * get_file (int fd)
   }
   return NULL;
 }
+
+#ifdef VM
+/* Pins each page of the SIZE bytes of user memory at BUFFER, which
+   must have been validated, in memory, first giving it a frame of
+   its own if WRITE is true and it shares one copy-on-write.
+   Terminates the process if a page does not exist, may not be
+   written, or cannot be brought in. */
+static void
+pin_buffer (void *buffer, size_t size, bool write)
+{
+  uint8_t *page;
+
+  for (page = pg_round_down (buffer); page < (uint8_t *) buffer + size;
+       page += PGSIZE)
+    if (!page_pin (page, write))
+    {
+      /* Unpin the pages before PAGE. */
+      uint8_t *first = pg_round_down (buffer);
+      unpin_buffer (first, page - first);
+      printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
+      thread_exit ();
+    }
+}
+
+/* Unpins the pages of the SIZE bytes of user memory at BUFFER,
+   which pin_buffer() pinned. */
+static void
+unpin_buffer (void *buffer, size_t size)
+{
+  uint8_t *page;
+
+  for (page = pg_round_down (buffer); page < (uint8_t *) buffer + size;
+       page += PGSIZE)
+    page_unpin (page);
+}
+#endif
@@ -1,6 +1,11 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/slab.h"
+
 void syscall_init (void);
 
+/* Cache of `struct file_object's. */
+extern struct kmem_cache *file_object_cache;
+
 #endif /* userprog/syscall.h */
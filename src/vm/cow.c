@@ -0,0 +1,280 @@
+#include "vm/cow.h"
+#include <debug.h>
+#include <list.h>
+#include <string.h>
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Copy-on-write frames.
+
+   fork() does not copy the pages that the parent has in memory.
+   Instead, the child's page maps the parent's frame, and both
+   mappings are made read-only.  The frame then belongs to a
+   "copy-on-write group", the list of pages that map it, rather
+   than to any one page.  The first write to any of them faults,
+   and cow_break() gives the writer a copy of its own, or, if it
+   is the last page in the group, the frame itself.
+
+   The frame table may evict a group's frame if none of its pages
+   has been accessed recently.  Every page in the group is then
+   written to a swap slot of its own, if it has been modified
+   since it was set up, and unmapped.  Eviction thus ends the
+   sharing, at the cost of one swap write per page.
+
+   A page joins or leaves a group only with its own lock held, or
+   that of the page it is copied from, so a thread that holds the
+   lock of every page in a group, as the evictor does, has the
+   group to itself.  Otherwise, cow_lock protects the groups and
+   the COW member of each page in one. */
+
+/* A frame shared copy-on-write. */
+struct cow
+  {
+    struct frame *frame;        /* Frame holding the pages. */
+    struct list pages;          /* `struct page's that map it. */
+  };
+
+static struct lock cow_lock;            /* Protects the groups. */
+
+/* Cache of `struct cow's. */
+static struct kmem_cache *cow_cache;
+
+static void unlock_pages (struct cow *, struct list_elem *end);
+
+/* Initializes copy-on-write sharing. */
+void
+cow_init (void)
+{
+  lock_init (&cow_lock);
+  cow_cache = kmem_cache_create ("cow", sizeof (struct cow), NULL);
+}
+
+/* Makes CHILD, a new page of a child process, map P's frame
+   copy-on-write, write-protecting P if it did not already share
+   its frame this way.  P must be writable and in a frame, and
+   the locks of both pages must be held.  Returns true if
+   successful, false if memory is not available. */
+bool
+cow_share (struct page *p, struct page *child)
+{
+  struct cow *c;
+  bool success = false;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (lock_held_by_current_thread (&child->lock));
+  ASSERT (p->writable && p->frame != NULL);
+
+  lock_acquire (&cow_lock);
+  c = p->cow;
+  if (c == NULL)
+    {
+      uint32_t *pd = p->thread->pagedir;
+
+      c = kmem_cache_alloc (cow_cache);
+      if (c == NULL)
+        goto done;
+      c->frame = p->frame;
+      list_init (&c->pages);
+      list_push_back (&c->pages, &p->cow_elem);
+      p->cow = c;
+      p->dirty = p->dirty || pagedir_is_dirty (pd, p->upage);
+      pagedir_set_writable (pd, p->upage, false);
+      frame_set_owner (c->frame, NULL, c);
+    }
+
+  if (pagedir_set_page (child->thread->pagedir, child->upage,
+                        c->frame->kpage, false))
+    {
+      list_push_back (&c->pages, &child->cow_elem);
+      child->cow = c;
+      child->frame = c->frame;
+      child->dirty = p->dirty;
+      success = true;
+    }
+
+ done:
+  lock_release (&cow_lock);
+  return success;
+}
+
+/* Gives page P, which maps a frame copy-on-write and whose lock
+   must be held, a frame of its own and maps it writable.
+   Returns true if successful, false if no frame is available. */
+bool
+cow_break (struct page *p)
+{
+  struct cow *c = p->cow;
+  uint32_t *pd = p->thread->pagedir;
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (c != NULL);
+
+  lock_acquire (&cow_lock);
+  if (list_size (&c->pages) == 1)
+    {
+      /* The last page in the group can just have the frame. */
+      list_remove (&p->cow_elem);
+      p->cow = NULL;
+      frame_set_owner (c->frame, p, NULL);
+      kmem_cache_free (cow_cache, c);
+      lock_release (&cow_lock);
+
+      pagedir_set_writable (pd, p->upage, true);
+      return true;
+    }
+  lock_release (&cow_lock);
+
+  /* The group's frame cannot be evicted while we hold P's lock,
+     and nobody can write to it, so copying it needs no lock. */
+  f = frame_alloc (p, false);
+  if (f == NULL)
+    return false;
+  memcpy (f->kpage, c->frame->kpage, PGSIZE);
+
+  cow_page_drop (p);
+  if (!pagedir_set_page (pd, p->upage, f->kpage, true))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  p->dirty = true;
+  frame_unpin (f);
+  return true;
+}
+
+/* Unmaps page P from its process, if it maps a frame
+   copy-on-write, and frees the frame if no other page maps it.
+   P's lock must be held. */
+void
+cow_page_drop (struct page *p)
+{
+  struct cow *c = p->cow;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  if (c == NULL)
+    return;
+
+  lock_acquire (&cow_lock);
+  pagedir_clear_page (p->thread->pagedir, p->upage);
+  list_remove (&p->cow_elem);
+  p->cow = NULL;
+  p->frame = NULL;
+  if (list_empty (&c->pages))
+    {
+      frame_free (c->frame);
+      kmem_cache_free (cow_cache, c);
+    }
+  lock_release (&cow_lock);
+}
+
+/* Tries to take group C for eviction, on behalf of the frame
+   table, whose lock must be held.  If any page in C has been
+   accessed since the last try, clears their accessed bits and
+   returns false.  Otherwise, acquires the lock of every page in
+   C and returns true.  Also returns false, without waiting, if
+   any of those locks or cow_lock is in use. */
+bool
+cow_try_evict (struct cow *c)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  if (lock_held_by_current_thread (&cow_lock)
+      || !lock_try_acquire (&cow_lock))
+    return false;
+
+  for (e = list_begin (&c->pages); e != list_end (&c->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, cow_elem);
+      uint32_t *pd = p->thread->pagedir;
+
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          pagedir_set_accessed (pd, p->upage, false);
+          accessed = true;
+        }
+    }
+  if (accessed)
+    {
+      lock_release (&cow_lock);
+      return false;
+    }
+
+  for (e = list_begin (&c->pages); e != list_end (&c->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, cow_elem);
+
+      if (lock_held_by_current_thread (&p->lock)
+          || !lock_try_acquire (&p->lock))
+        {
+          unlock_pages (c, e);
+          lock_release (&cow_lock);
+          return false;
+        }
+    }
+
+  lock_release (&cow_lock);
+  return true;
+}
+
+/* Evicts group C, taken by cow_try_evict(), from its frame:
+   writes each of its pages that has been modified to swap,
+   unmaps them, releases their locks, and frees C.  Returns true
+   if successful.  If the swap area fills up, returns false
+   instead, leaving the pages not yet written in C and in the
+   frame. */
+bool
+cow_evict (struct cow *c)
+{
+  void *kpage = c->frame->kpage;
+
+  while (!list_empty (&c->pages))
+    {
+      struct page *p = list_entry (list_front (&c->pages),
+                                   struct page, cow_elem);
+      uint32_t *pd = p->thread->pagedir;
+
+      ASSERT (lock_held_by_current_thread (&p->lock));
+
+      pagedir_clear_page (pd, p->upage);
+      if (p->dirty || pagedir_is_dirty (pd, p->upage))
+        {
+          p->dirty = true;
+          p->swap_slot = swap_out (kpage);
+          if (p->swap_slot == SWAP_NONE)
+            {
+              pagedir_set_page (pd, p->upage, kpage, false);
+              unlock_pages (c, list_end (&c->pages));
+              return false;
+            }
+        }
+      list_pop_front (&c->pages);
+      p->cow = NULL;
+      p->frame = NULL;
+      lock_release (&p->lock);
+    }
+
+  kmem_cache_free (cow_cache, c);
+  return true;
+}
+
+/* Releases the locks of the pages in C that precede END. */
+static void
+unlock_pages (struct cow *c, struct list_elem *end)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&c->pages); e != end; e = list_next (e))
+    lock_release (&list_entry (e, struct page, cow_elem)->lock);
+}
@@ -0,0 +1,16 @@
+#ifndef VM_COW_H
+#define VM_COW_H
+
+#include <stdbool.h>
+
+struct page;
+struct cow;
+
+void cow_init (void);
+bool cow_share (struct page *, struct page *child);
+bool cow_break (struct page *);
+void cow_page_drop (struct page *);
+bool cow_try_evict (struct cow *);
+bool cow_evict (struct cow *);
+
+#endif /* vm/cow.h */
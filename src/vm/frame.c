@@ -0,0 +1,225 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/cow.h"
+#include "vm/page.h"
+#include "vm/share.h"
+
+/* Frame table.
+
+   Every frame that holds a user page is on a single list, in
+   the order that a "clock" hand sweeps over it when memory runs
+   out.  The hand skips pinned frames, which are being filled or
+   emptied or which a system call is accessing, and gives each
+   frame whose page has been accessed since the last sweep a
+   second chance, clearing its accessed bit.  The first other
+   frame it finds is evicted: page_out() writes its page to swap
+   if necessary and unmaps it, and the frame is reused.  A frame
+   shared between processes is handed to share_evict() instead,
+   which gives it a second chance if any of them has accessed it,
+   and one shared copy-on-write to cow_try_evict() and
+   cow_evict() likewise.
+
+   frame_lock protects the list, the hand, and the frames'
+   PAGE, SHARE, COW and PIN_CNT members, except that whoever has a
+   frame pinned may set its PAGE, SHARE and COW.  A frame may be
+   pinned more than once, e.g. by each of several processes whose
+   system calls access the same shared frame, and is eligible for
+   eviction again only when every pin is dropped.  Eviction I/O
+   happens without it, with the victim pinned and its pages'
+   locks held instead. */
+
+static struct list frames;              /* All frames. */
+static struct list_elem *hand;          /* Clock hand, or null. */
+static struct lock frame_lock;          /* Protects the above. */
+
+/* Cache of `struct frame's. */
+static struct kmem_cache *frame_cache;
+
+static struct frame *choose_victim (void);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  list_init (&frames);
+  hand = NULL;
+  lock_init (&frame_lock);
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), NULL);
+}
+
+/* Obtains a frame for page P, or for a shared page if P is
+   null, evicting another page if the user pool is exhausted, and
+   returns it pinned.  If ZERO is true, the frame is zeroed.
+   Returns a null pointer if no frame can be found. */
+struct frame *
+frame_alloc (struct page *p, bool zero)
+{
+  struct frame *f;
+  void *kpage;
+  bool evicted;
+
+  kpage = palloc_get_page (PAL_USER | (zero ? PAL_ZERO : 0));
+  if (kpage != NULL)
+    {
+      f = kmem_cache_alloc (frame_cache);
+      if (f == NULL)
+        {
+          palloc_free_page (kpage);
+          return NULL;
+        }
+      f->kpage = kpage;
+      f->page = p;
+      f->share = NULL;
+      f->cow = NULL;
+      f->pin_cnt = 1;
+
+      lock_acquire (&frame_lock);
+      list_push_back (&frames, &f->elem);
+      lock_release (&frame_lock);
+      return f;
+    }
+
+  /* Memory is short.  Evict a page to make room. */
+  lock_acquire (&frame_lock);
+  f = choose_victim ();
+  lock_release (&frame_lock);
+  if (f == NULL)
+    return NULL;
+  if (f->cow != NULL)
+    evicted = cow_evict (f->cow);
+  else
+    evicted = f->page == NULL || page_out (f->page);
+  if (!evicted)
+    {
+      frame_unpin (f);
+      return NULL;
+    }
+
+  lock_acquire (&frame_lock);
+  f->page = p;
+  f->cow = NULL;
+  lock_release (&frame_lock);
+  if (zero)
+    memset (f->kpage, 0, PGSIZE);
+  return f;
+}
+
+/* Pins frame F, which must be in use and must not be evicted
+   meanwhile, e.g. because the caller holds the lock of a page it
+   holds, so that it is not evicted until frame_unpin(). */
+void
+frame_pin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  f->pin_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Drops a pin of frame F, making it eligible for eviction again
+   if that was the last one. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  ASSERT (f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Makes frame F, which holds a page whose lock the caller holds,
+   belong to page P if C is null, or to the pages of copy-on-write
+   group C otherwise, in which case P must be null. */
+void
+frame_set_owner (struct frame *f, struct page *p, struct cow *c)
+{
+  ASSERT ((p == NULL) != (c == NULL));
+
+  lock_acquire (&frame_lock);
+  f->page = p;
+  f->cow = c;
+  lock_release (&frame_lock);
+}
+
+/* Removes frame F from the frame table and frees its memory.
+   F's page must already be unmapped. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  if (hand == &f->elem)
+    hand = list_next (hand);
+  list_remove (&f->elem);
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  kmem_cache_free (frame_cache, f);
+}
+
+/* Sweeps the clock hand over the frame table, at most twice, and
+   returns the first frame that is neither pinned nor recently
+   accessed and whose page's lock can be taken without waiting.
+   Returns the frame pinned, with its page's lock held by the
+   caller, or a null pointer if there is no such frame.  If the
+   frame was shared, it has already been evicted, and its PAGE
+   is null; if it was shared copy-on-write, the locks of all the
+   pages in its COW group are held instead.
+   frame_lock must be held. */
+static struct frame *
+choose_victim (void)
+{
+  size_t i, n;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  n = 2 * list_size (&frames);
+  for (i = 0; i < n; i++)
+    {
+      struct frame *f;
+      struct page *p;
+      uint32_t *pd;
+
+      if (hand == NULL || hand == list_end (&frames))
+        hand = list_begin (&frames);
+      f = list_entry (hand, struct frame, elem);
+      hand = list_next (hand);
+
+      if (f->pin_cnt > 0)
+        continue;
+      if (f->share != NULL)
+        {
+          if (!share_evict (f->share))
+            continue;
+          f->share = NULL;
+          f->pin_cnt = 1;
+          return f;
+        }
+      if (f->cow != NULL)
+        {
+          if (!cow_try_evict (f->cow))
+            continue;
+          f->pin_cnt = 1;
+          return f;
+        }
+      p = f->page;
+      pd = p->thread->pagedir;
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          pagedir_set_accessed (pd, p->upage, false);
+          continue;
+        }
+      if (lock_held_by_current_thread (&p->lock)
+          || !lock_try_acquire (&p->lock))
+        continue;
+
+      f->pin_cnt = 1;
+      return f;
+    }
+  return NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct cow;
+struct page;
+
+/* A physical frame holding a user page. */
+struct frame
+  {
+    void *kpage;                /* Kernel virtual address. */
+    struct page *page;          /* Page held in this frame, or null. */
+    struct share *share;        /* Shared page held, or null. */
+    struct cow *cow;            /* Copy-on-write group, or null. */
+    unsigned pin_cnt;           /* Exempt from eviction if nonzero. */
+    struct list_elem elem;      /* Element in frame table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, bool zero);
+void frame_pin (struct frame *);
+void frame_unpin (struct frame *);
+void frame_set_owner (struct frame *, struct page *, struct cow *);
+void frame_free (struct frame *);
+
+#endif /* vm/frame.h */
@@ -0,0 +1,145 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* Memory-mapped files.
+
+   A mapping makes the contents of a file appear at a range of
+   consecutive pages in a process's address space.  Nothing is
+   read when the mapping is made: each page is added to the
+   supplemental page table as a page of the file, and is read in
+   through the file system, and so the buffer cache, on its first
+   access.  A page the process modifies is written back to the
+   file, rather than to swap, when it is evicted and when the
+   mapping goes away, whether by munmap or by process exit.
+
+   The mapping has its own reopened file, so that it stays valid
+   after the process closes the file descriptor it was made
+   from. */
+
+/* A memory-mapped file. */
+struct mapping
+  {
+    struct list_elem elem;      /* Element in thread's `mappings'. */
+    mapid_t id;                 /* Mapping identifier. */
+    struct file *file;          /* Mapped file. */
+    uint8_t *base;              /* First mapped page. */
+    size_t page_cnt;            /* Number of mapped pages. */
+  };
+
+static struct mapping *lookup_mapping (mapid_t);
+static void unmap (struct mapping *);
+
+/* Maps FILE into the current process's address space starting
+   at ADDR.  Returns the new mapping's identifier, or MAP_FAILED
+   if FILE is empty, ADDR is null or not page-aligned, or the
+   range of pages the file would occupy is not all unused user
+   address space. */
+mapid_t
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *t = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t i;
+
+  length = file_length (file);
+  if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+    return MAP_FAILED;
+
+  m = malloc (sizeof *m);
+  if (m == NULL)
+    return MAP_FAILED;
+  m->file = file_reopen (file);
+  if (m->file == NULL)
+    {
+      free (m);
+      return MAP_FAILED;
+    }
+  m->base = addr;
+  m->page_cnt = DIV_ROUND_UP (length, PGSIZE);
+
+  for (i = 0; i < m->page_cnt; i++)
+    {
+      uint8_t *upage = m->base + i * PGSIZE;
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+
+      if (!is_user_vaddr (upage) || upage + PGSIZE > (uint8_t *) PHYS_BASE
+          || !page_add_mmap (upage, m->file, ofs, read_bytes))
+        {
+          /* Take back the pages added so far. */
+          m->page_cnt = i;
+          unmap (m);
+          return MAP_FAILED;
+        }
+    }
+
+  m->id = t->next_mapid++;
+  list_push_back (&t->mappings, &m->elem);
+  return m->id;
+}
+
+/* Unmaps the current process's mapping with the given ID, if
+   any, writing its modified pages back to its file. */
+void
+mmap_unmap (mapid_t id)
+{
+  struct mapping *m = lookup_mapping (id);
+
+  if (m != NULL)
+    {
+      list_remove (&m->elem);
+      unmap (m);
+    }
+}
+
+/* Unmaps all of the current process's mappings, writing their
+   modified pages back to their files.  Called on process
+   exit. */
+void
+mmap_unmap_all (void)
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    unmap (list_entry (list_pop_front (mappings), struct mapping, elem));
+}
+
+/* Returns the current process's mapping with the given ID, or a
+   null pointer if there is none. */
+static struct mapping *
+lookup_mapping (mapid_t id)
+{
+  struct list *mappings = &thread_current ()->mappings;
+  struct list_elem *e;
+
+  for (e = list_begin (mappings); e != list_end (mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id)
+        return m;
+    }
+  return NULL;
+}
+
+/* Removes M's pages from the current process, closes its file,
+   and frees it.  M must not be in the process's list of
+   mappings. */
+static void
+unmap (struct mapping *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->page_cnt; i++)
+    page_remove (m->base + i * PGSIZE);
+  file_close (m->file);
+  free (m);
+}
@@ -0,0 +1,510 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/cow.h"
+#include "vm/frame.h"
+#include "vm/share.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process has a hash table, keyed by user virtual address,
+   of the pages in its address space.  A page is added to the
+   table when it is set up, e.g. by load() for each page of an
+   executable segment, but no memory is given to it then.  The
+   first access to the page faults, and page_in() reads the page
+   from its file or zeroes it, and only then maps it into the
+   process's page directory.  Thus a process only pays for the
+   pages it actually touches.
+
+   When memory runs short, the frame table picks a page to evict
+   and calls page_out() on it.  A page that has never been
+   modified is simply dropped, to be read or zeroed again on its
+   next access; any other page is written to swap first, except
+   that a page of a memory-mapped file is written back to the
+   file instead.
+
+   Each page's lock is held while the page is brought in or
+   evicted, so that its owner, faulting on a page that is being
+   evicted, waits until eviction is done before bringing it back
+   in.  A system call pins the pages of the user buffers it
+   accesses with page_pin(), so that they are not evicted until
+   it is done and the kernel does not fault on them while it
+   holds file system locks.
+
+   Read-only pages of a file are not given frames of their own,
+   but mapped to frames shared with other processes by
+   vm/share.c.  A process created by fork() gets a copy of its
+   parent's table, with the pages the parent has in memory shared
+   copy-on-write by vm/cow.c. */
+
+/* Cache of `struct page's. */
+static struct kmem_cache *page_cache;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *page_create (void *upage, struct file *, off_t ofs,
+                                 size_t read_bytes, bool writable);
+static bool page_add (struct page *);
+static bool load_page (struct page *, bool pin);
+static void page_free (struct page *);
+static void page_write_back (struct page *);
+
+/* Constructs a page in PAGE_CACHE. */
+static void
+page_ctor (void *p_)
+{
+  struct page *p = p_;
+  lock_init (&p->lock);
+}
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), page_ctor);
+  frame_init ();
+  share_init ();
+  cow_init ();
+}
+
+/* Initializes PAGES as an empty supplemental page table.
+   Returns true if successful, false if memory is not
+   available. */
+bool
+page_table_init (struct hash *pages)
+{
+  return hash_init (pages, page_hash, page_less, NULL);
+}
+
+/* Frees the supplemental page table PAGES, along with the frames
+   and swap slots that hold its pages.  Must be called before the
+   page directory is destroyed. */
+void
+page_table_destroy (struct hash *pages)
+{
+  hash_destroy (pages, page_destroy);
+}
+
+/* Copies the supplemental page table of PARENT, which must be
+   blocked, into the current process's empty one, for fork().
+   Pages of memory-mapped files are not copied.  The copies of
+   pages that PARENT has in memory share its frames copy-on-write,
+   pages in swap are copied to new swap slots, and the rest are
+   brought in from their files or zeroed on first access, as in
+   PARENT.  The current process's executable must already be
+   open.  Returns true if successful, false if memory or swap
+   space ran out. */
+bool
+page_table_copy (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct hash_iterator i;
+
+  hash_first (&i, &parent->pages);
+  while (hash_next (&i))
+    {
+      struct page *pp = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *p;
+      bool success = true;
+
+      if (pp->write_back)
+        continue;
+
+      /* Every other file page is from the executable. */
+      ASSERT (pp->file == NULL || pp->file == parent->exec_file);
+      p = page_create (pp->upage, pp->file != NULL ? cur->exec_file : NULL,
+                       pp->file_ofs, pp->read_bytes, pp->writable);
+      if (p == NULL || !page_add (p))
+        return false;
+
+      /* A read-only page never differs from what it was loaded
+         from, the executable or zeros, so the child brings it in
+         on demand just as PARENT did.  Only writable pages are
+         shared copy-on-write. */
+      lock_acquire (&pp->lock);
+      lock_acquire (&p->lock);
+      if (pp->writable && pp->frame != NULL)
+        success = cow_share (pp, p);
+      else if (pp->writable && pp->swap_slot != SWAP_NONE)
+        {
+          p->swap_slot = swap_copy (pp->swap_slot);
+          p->dirty = true;
+          success = p->swap_slot != SWAP_NONE;
+        }
+      lock_release (&p->lock);
+      lock_release (&pp->lock);
+      if (!success)
+        return false;
+    }
+  return true;
+}
+
+/* Adds a page at UPAGE in the current process whose first
+   READ_BYTES bytes are read from FILE starting at offset OFS
+   and whose remaining bytes are zeroed.  The process may write
+   the page if WRITABLE is true.  FILE must stay open as long as
+   the page exists.  Returns true if successful, false if UPAGE
+   is already in use or memory is not available. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p = page_create (upage, file, ofs, read_bytes, writable);
+  return p != NULL && page_add (p);
+}
+
+/* Adds an all-zero page at UPAGE in the current process, which
+   the process may write if WRITABLE is true.  Returns true if
+   successful, false if UPAGE is already in use or memory is not
+   available. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  return page_add_file (upage, NULL, 0, 0, writable);
+}
+
+/* Adds a writable page at UPAGE in the current process that maps
+   READ_BYTES bytes of FILE starting at offset OFS, followed by
+   zeros.  Changes to those bytes are written back to FILE when
+   the page is evicted or removed.  FILE must stay open as long
+   as the page exists.  Returns true if successful, false if
+   UPAGE is already in use or memory is not available. */
+bool
+page_add_mmap (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes)
+{
+  struct page *p = page_create (upage, file, ofs, read_bytes, true);
+  if (p == NULL)
+    return false;
+  p->write_back = true;
+  return page_add (p);
+}
+
+/* Removes the current process's page at UPAGE, if any, writing
+   it back to its file if it is memory-mapped and modified. */
+void
+page_remove (void *upage)
+{
+  struct page *p = page_lookup (upage);
+
+  if (p != NULL)
+    {
+      hash_delete (&thread_current ()->pages, &p->hash_elem);
+      page_free (p);
+    }
+}
+
+/* Returns the current process's page that contains UPAGE, or a
+   null pointer if there is none. */
+struct page *
+page_lookup (const void *upage)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  p.upage = pg_round_down (upage);
+  e = hash_find (&thread_current ()->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Brings the current process's page that contains ADDR into
+   memory and maps it.  Returns true if successful, false if
+   there is no such page or it could not be brought in. */
+bool
+page_in (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  bool success;
+
+  if (p == NULL)
+    return false;
+
+  lock_acquire (&p->lock);
+  success = load_page (p, false);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Brings the current process's page that contains ADDR into
+   memory, like page_in(), and pins it there, so that the kernel
+   can access it on the process's behalf without faulting, even
+   with file system locks held.  If WRITE is true, the kernel
+   will write to the page, so it is first given a frame of its
+   own if it shares one copy-on-write.  Each successful call must
+   be matched by a call to page_unpin().  Returns true if
+   successful, false if there is no such page, WRITE is true but
+   it may not be written, or it could not be brought in. */
+bool
+page_pin (const void *addr, bool write)
+{
+  struct page *p = page_lookup (addr);
+  bool success;
+
+  if (p == NULL || (write && !p->writable))
+    return false;
+
+  lock_acquire (&p->lock);
+  success = ((!write || p->cow == NULL || cow_break (p))
+             && load_page (p, true));
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Unpins the current process's page that contains ADDR, which
+   page_pin() pinned. */
+void
+page_unpin (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+
+  ASSERT (p != NULL);
+
+  lock_acquire (&p->lock);
+  if (p->frame != NULL)
+    frame_unpin (p->frame);
+  else
+    share_page_unpin (p);
+  lock_release (&p->lock);
+}
+
+/* Evicts page P from its frame, on behalf of the frame table:
+   unmaps it from its process and, if it has been modified,
+   writes it to swap.  P's lock must be held; it is released
+   before returning.  Returns true if successful, false if P had
+   to be written to swap but the swap area is full, in which case
+   P stays in its frame. */
+bool
+page_out (struct page *p)
+{
+  uint32_t *pd = p->thread->pagedir;
+  struct frame *f = p->frame;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (f != NULL);
+
+  /* Unmap the page first, so that the process cannot modify it
+     while we write it out. */
+  pagedir_clear_page (pd, p->upage);
+  if (p->write_back)
+    page_write_back (p);
+  else if (p->dirty || pagedir_is_dirty (pd, p->upage))
+    {
+      p->dirty = true;
+      p->swap_slot = swap_out (f->kpage);
+      if (p->swap_slot == SWAP_NONE)
+        {
+          pagedir_set_page (pd, p->upage, f->kpage, p->writable);
+          lock_release (&p->lock);
+          return false;
+        }
+    }
+
+  p->frame = NULL;
+  lock_release (&p->lock);
+  return true;
+}
+
+/* Handles a write by the current process to its page that
+   contains ADDR, which is mapped read-only because it shares its
+   frame copy-on-write, by giving the page a frame of its own.
+   Returns true if successful, false if there is no such page,
+   it may not be written, or no frame is available. */
+bool
+page_unshare (const void *addr)
+{
+  struct page *p = page_lookup (addr);
+  bool success = true;
+
+  if (p == NULL || !p->writable)
+    return false;
+
+  lock_acquire (&p->lock);
+  /* If the page was evicted since the fault, its next access
+     will bring it back in writable. */
+  if (p->cow != NULL)
+    success = cow_break (p);
+  lock_release (&p->lock);
+  return success;
+}
+
+/* Creates and returns a page at UPAGE in the current process,
+   not yet in its supplemental page table, whose first READ_BYTES
+   bytes come from FILE at offset OFS and whose remaining bytes
+   are zeros.  Returns a null pointer if memory is not
+   available. */
+static struct page *
+page_create (void *upage, struct file *file, off_t ofs,
+             size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return NULL;
+  p->upage = upage;
+  p->thread = thread_current ();
+  p->writable = writable;
+  p->frame = NULL;
+  p->swap_slot = SWAP_NONE;
+  p->dirty = false;
+  p->cow = NULL;
+  p->share = NULL;
+  p->file = read_bytes > 0 ? file : NULL;
+  p->file_ofs = ofs;
+  p->read_bytes = read_bytes;
+  p->write_back = false;
+  return p;
+}
+
+/* Brings page P, whose lock must be held, into memory and maps
+   it, unless it is there already.  If PIN is true, also pins the
+   frame that holds it.  Returns true if successful, false if it
+   could not be brought in. */
+static bool
+load_page (struct page *p, bool pin)
+{
+  struct frame *f;
+  uint8_t *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  if (p->frame != NULL)
+    {
+      /* Already brought in.  The frame cannot be evicted while
+         we hold P's lock. */
+      if (pin)
+        frame_pin (p->frame);
+      return true;
+    }
+
+  /* Read-only file pages are shared between processes. */
+  if (p->file != NULL && !p->writable)
+    return share_page_in (p, pin);
+
+  /* An all-zero page can come straight from the pool of
+     pre-zeroed pages. */
+  f = frame_alloc (p, p->swap_slot == SWAP_NONE && p->file == NULL);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (p->swap_slot != SWAP_NONE)
+    {
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_NONE;
+    }
+  else if (p->file != NULL)
+    {
+      if (file_read_at (p->file, kpage, p->read_bytes, p->file_ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (f);
+          return false;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (p->thread->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  if (!pin)
+    frame_unpin (f);
+  return true;
+}
+
+/* If memory-mapped page P, which must be in a frame and unmapped
+   or about to be, was modified, writes it back to its file.  P's
+   lock must be held. */
+static void
+page_write_back (struct page *p)
+{
+  ASSERT (p->write_back);
+  ASSERT (p->frame != NULL);
+
+  if (pagedir_is_dirty (p->thread->pagedir, p->upage))
+    {
+      file_write_at (p->file, p->frame->kpage, p->read_bytes, p->file_ofs);
+      pagedir_set_dirty (p->thread->pagedir, p->upage, false);
+    }
+}
+
+/* Inserts P into the current process's supplemental page table,
+   or frees it and returns false if its address is in use. */
+static bool
+page_add (struct page *p)
+{
+  if (hash_insert (&thread_current ()->pages, &p->hash_elem) != NULL)
+    {
+      kmem_cache_free (page_cache, p);
+      return false;
+    }
+  return true;
+}
+
+/* Returns a hash value for the page that E refers to. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+
+  return a->upage < b->upage;
+}
+
+/* Frees the page that E refers to. */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  page_free (hash_entry (e, struct page, hash_elem));
+}
+
+/* Frees page P, which has been removed from its supplemental
+   page table, with its frame or swap slot, first writing it back
+   to its file if it is memory-mapped and modified. */
+static void
+page_free (struct page *p)
+{
+  /* Wait for any eviction in progress to finish. */
+  lock_acquire (&p->lock);
+  share_page_drop (p);
+  cow_page_drop (p);
+  if (p->frame != NULL)
+    {
+      pagedir_clear_page (p->thread->pagedir, p->upage);
+      if (p->write_back)
+        page_write_back (p);
+      frame_free (p->frame);
+      p->frame = NULL;
+    }
+  if (p->swap_slot != SWAP_NONE)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_NONE;
+    }
+  lock_release (&p->lock);
+
+  kmem_cache_free (page_cache, p);
+}
@@ -0,0 +1,64 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct file;
+struct thread;
+
+/* A virtual page of a user process that is not necessarily
+   present in memory.  The supplemental page table records how
+   to bring in each such page when it is first accessed. */
+struct page
+  {
+    void *upage;                /* User virtual address. */
+    struct hash_elem hash_elem; /* Element in thread's `pages'. */
+    struct thread *thread;      /* Owning process. */
+    bool writable;              /* May the process write it? */
+    struct lock lock;           /* Held while moving the page. */
+
+    /* Where the page is now.  Protected by LOCK. */
+    struct frame *frame;        /* Frame holding it, or null. */
+    size_t swap_slot;           /* Swap slot holding it, or SWAP_NONE. */
+    bool dirty;                 /* Modified since it was set up? */
+
+    /* Writable pages only.  Protected by vm/cow.c. */
+    struct cow *cow;            /* Copy-on-write group of FRAME, or null. */
+    struct list_elem cow_elem;  /* Element in cow's page list. */
+
+    /* Read-only file pages only.  Protected by vm/share.c. */
+    struct share *share;        /* Shared frame it maps, or null. */
+    struct list_elem share_elem; /* Element in share's page list. */
+
+    /* Initial contents: READ_BYTES bytes from FILE starting at
+       FILE_OFS, then zeros.  FILE is null for an all-zero page. */
+    struct file *file;          /* File to read from, or null. */
+    off_t file_ofs;             /* Offset in FILE. */
+    size_t read_bytes;          /* Bytes to read from FILE. */
+    bool write_back;            /* Write changes back to FILE? */
+  };
+
+void page_init (void);
+bool page_table_init (struct hash *);
+void page_table_destroy (struct hash *);
+bool page_table_copy (struct thread *parent);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_add_mmap (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes);
+void page_remove (void *upage);
+struct page *page_lookup (const void *upage);
+bool page_in (const void *addr);
+bool page_pin (const void *addr, bool write);
+void page_unpin (const void *addr);
+bool page_out (struct page *);
+bool page_unshare (const void *addr);
+
+#endif /* vm/page.h */
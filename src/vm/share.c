@@ -0,0 +1,287 @@
+#include "vm/share.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+/* Shared read-only pages.
+
+   Read-only pages of a file, in practice the text of an
+   executable, are the same for every process that maps them, so
+   they are kept in a single frame that all such processes map.
+   A hash table, keyed by inode, file offset and number of bytes
+   read, records each shared frame and the list of pages that
+   map it.  The frame is freed when the last of those pages is
+   dropped.
+
+   The frame table may also evict a shared frame, if none of the
+   processes mapping it has accessed it recently.  Eviction
+   unmaps it from all of them; since it is read-only, it is never
+   written anywhere, and the next access reads it again.
+
+   A page is read into a new shared frame without share_lock held,
+   so that faults on other shared pages need not wait for the
+   read.  Its entry goes into the table first, marked as loading,
+   and a process that faults on the same page meanwhile waits on
+   the entry's condition variable until the read is done.
+
+   share_lock protects the table, the entries, the lists of
+   mapping pages, and the SHARE member of each page. */
+
+/* A shared frame. */
+struct share
+  {
+    struct hash_elem hash_elem; /* Element in `shares'. */
+    struct inode *inode;        /* File's inode. */
+    off_t ofs;                  /* Offset in file. */
+    size_t read_bytes;          /* Bytes read from file; rest zero. */
+    struct frame *frame;        /* Frame holding the page. */
+    struct list pages;          /* `struct page's that map it. */
+    bool loading;               /* Frame still being read in? */
+    struct condition loaded;    /* Signaled when LOADING turns false. */
+  };
+
+static struct hash shares;              /* All shared frames. */
+static struct lock share_lock;          /* Protects the above. */
+
+/* Cache of `struct share's. */
+static struct kmem_cache *share_cache;
+
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+static void share_free (struct share *);
+
+/* Initializes the shared page table. */
+void
+share_init (void)
+{
+  if (!hash_init (&shares, share_hash, share_less, NULL))
+    PANIC ("shared page table creation failed");
+  lock_init (&share_lock);
+  share_cache = kmem_cache_create ("share", sizeof (struct share), NULL);
+}
+
+/* Maps read-only file page P into its process, using the frame
+   that already holds that part of the file if there is one, and
+   otherwise reading it into a new shared frame.  If PIN is true,
+   also pins that frame.  P's lock must be held.  Returns true if
+   successful, false on failure. */
+bool
+share_page_in (struct page *p, bool pin)
+{
+  struct share key, *s;
+  struct hash_elem *e;
+  bool success = false;
+
+  ASSERT (p->file != NULL && !p->writable);
+  ASSERT (lock_held_by_current_thread (&p->lock));
+
+  lock_acquire (&share_lock);
+  if (p->share != NULL)
+    {
+      /* Already mapped. */
+      if (pin)
+        frame_pin (p->share->frame);
+      lock_release (&share_lock);
+      return true;
+    }
+
+  key.inode = file_get_inode (p->file);
+  key.ofs = p->file_ofs;
+  key.read_bytes = p->read_bytes;
+  for (;;)
+    {
+      e = hash_find (&shares, &key.hash_elem);
+      if (e == NULL)
+        break;
+      s = hash_entry (e, struct share, hash_elem);
+      if (!s->loading)
+        break;
+
+      /* Another process is reading the page in.  Wait for it,
+         then look again, since the read may have failed. */
+      cond_wait (&s->loaded, &share_lock);
+    }
+  if (e == NULL)
+    {
+      /* Read the page into a new shared frame. */
+      struct frame *f;
+      bool loaded;
+
+      s = kmem_cache_alloc (share_cache);
+      if (s == NULL)
+        goto done;
+      s->inode = key.inode;
+      s->ofs = key.ofs;
+      s->read_bytes = key.read_bytes;
+      s->frame = NULL;
+      list_init (&s->pages);
+      s->loading = true;
+      cond_init (&s->loaded);
+      hash_insert (&shares, &s->hash_elem);
+      lock_release (&share_lock);
+
+      f = frame_alloc (NULL, false);
+      loaded = (f != NULL
+                && (file_read_at (p->file, f->kpage, p->read_bytes,
+                                  p->file_ofs)
+                    == (off_t) p->read_bytes));
+      if (loaded)
+        memset ((uint8_t *) f->kpage + p->read_bytes, 0,
+                PGSIZE - p->read_bytes);
+
+      lock_acquire (&share_lock);
+      s->loading = false;
+      cond_broadcast (&s->loaded, &share_lock);
+      if (!loaded)
+        {
+          if (f != NULL)
+            frame_free (f);
+          hash_delete (&shares, &s->hash_elem);
+          kmem_cache_free (share_cache, s);
+          goto done;
+        }
+      s->frame = f;
+      f->share = s;
+      frame_unpin (f);
+    }
+
+  if (pagedir_set_page (p->thread->pagedir, p->upage, s->frame->kpage,
+                        false))
+    {
+      list_push_back (&s->pages, &p->share_elem);
+      p->share = s;
+      if (pin)
+        frame_pin (s->frame);
+      success = true;
+    }
+  else if (list_empty (&s->pages))
+    share_free (s);
+
+ done:
+  lock_release (&share_lock);
+  return success;
+}
+
+/* Unmaps page P from its process, if it maps a shared frame, and
+   frees the frame if no other page maps it. */
+void
+share_page_drop (struct page *p)
+{
+  struct share *s;
+
+  lock_acquire (&share_lock);
+  s = p->share;
+  if (s != NULL)
+    {
+      pagedir_clear_page (p->thread->pagedir, p->upage);
+      list_remove (&p->share_elem);
+      p->share = NULL;
+      if (list_empty (&s->pages))
+        share_free (s);
+    }
+  lock_release (&share_lock);
+}
+
+/* Unpins the shared frame that page P, which share_page_in()
+   pinned, maps. */
+void
+share_page_unpin (struct page *p)
+{
+  lock_acquire (&share_lock);
+  ASSERT (p->share != NULL);
+  frame_unpin (p->share->frame);
+  lock_release (&share_lock);
+}
+
+/* Tries to evict shared frame S, on behalf of the frame table,
+   whose lock must be held.  If any process that maps S has
+   accessed it since the last try, clears their accessed bits and
+   returns false.  Otherwise, unmaps S from every process,
+   forgets it, and returns true; S's frame is then the caller's
+   to reuse.  Also returns false, without waiting, if another
+   thread is using the shared page table. */
+bool
+share_evict (struct share *s)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  if (lock_held_by_current_thread (&share_lock)
+      || !lock_try_acquire (&share_lock))
+    return false;
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+       e = list_next (e))
+    {
+      struct page *p = list_entry (e, struct page, share_elem);
+      uint32_t *pd = p->thread->pagedir;
+
+      if (pagedir_is_accessed (pd, p->upage))
+        {
+          pagedir_set_accessed (pd, p->upage, false);
+          accessed = true;
+        }
+    }
+
+  if (!accessed)
+    {
+      while (!list_empty (&s->pages))
+        {
+          struct page *p = list_entry (list_pop_front (&s->pages),
+                                       struct page, share_elem);
+          pagedir_clear_page (p->thread->pagedir, p->upage);
+          p->share = NULL;
+        }
+      hash_delete (&shares, &s->hash_elem);
+      kmem_cache_free (share_cache, s);
+    }
+
+  lock_release (&share_lock);
+  return !accessed;
+}
+
+/* Removes S, which no page maps, from the table and frees it
+   with its frame.  share_lock must be held. */
+static void
+share_free (struct share *s)
+{
+  ASSERT (lock_held_by_current_thread (&share_lock));
+  ASSERT (list_empty (&s->pages));
+
+  hash_delete (&shares, &s->hash_elem);
+  frame_free (s->frame);
+  kmem_cache_free (share_cache, s);
+}
+
+/* Returns a hash value for the shared frame that E refers to. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct share *s = hash_entry (e, struct share, hash_elem);
+  return hash_bytes (&s->inode, sizeof s->inode) ^ hash_int (s->ofs);
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct share *a = hash_entry (a_, struct share, hash_elem);
+  const struct share *b = hash_entry (b_, struct share, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
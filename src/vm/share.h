@@ -0,0 +1,15 @@
+#ifndef VM_SHARE_H
+#define VM_SHARE_H
+
+#include <stdbool.h>
+
+struct page;
+struct share;
+
+void share_init (void);
+bool share_page_in (struct page *, bool pin);
+void share_page_unpin (struct page *);
+void share_page_drop (struct page *);
+bool share_evict (struct share *);
+
+#endif /* vm/share.h */
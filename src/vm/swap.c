@@ -0,0 +1,110 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap area.
+
+   The swap block device is divided into page-size "slots", each
+   SECTORS_PER_SLOT sectors long.  A bitmap records which slots
+   are in use.  If there is no swap device, there are no slots,
+   and swap_out() always fails. */
+
+/* Number of sectors in a swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;       /* Swap device, or null. */
+static struct bitmap *used_slots;       /* Slots in use. */
+static struct lock swap_lock;           /* Protects used_slots. */
+
+static void swap_read (size_t slot, void *kpage);
+
+/* Initializes the swap area.  Must be called after the block
+   devices have been assigned their roles. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  else
+    printf ("No swap device found, can't swap out dirty pages.\n");
+
+  used_slots = bitmap_create (slot_cnt);
+  if (used_slots == NULL)
+    PANIC ("swap bitmap creation failed");
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_NONE if the swap area is full. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot;
+  size_t i;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (used_slots, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_write (swap_device, slot * SECTORS_PER_SLOT + i,
+                 (const uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+  return slot;
+}
+
+/* Reads swap slot SLOT into the page at KPAGE and frees the
+   slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  swap_read (slot, kpage);
+  swap_free (slot);
+}
+
+/* Writes a copy of swap slot SLOT to a free slot and returns
+   the new slot, or SWAP_NONE if the swap area is full or memory
+   is not available. */
+size_t
+swap_copy (size_t slot)
+{
+  void *kpage = palloc_get_page (0);
+  size_t copy;
+
+  if (kpage == NULL)
+    return SWAP_NONE;
+  swap_read (slot, kpage);
+  copy = swap_out (kpage);
+  palloc_free_page (kpage);
+  return copy;
+}
+
+/* Frees swap slot SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (used_slots, slot));
+  bitmap_reset (used_slots, slot);
+  lock_release (&swap_lock);
+}
+
+/* Reads swap slot SLOT into the page at KPAGE. */
+static void
+swap_read (size_t slot, void *kpage)
+{
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_read (swap_device, slot * SECTORS_PER_SLOT + i,
+                (uint8_t *) kpage + i * BLOCK_SECTOR_SIZE);
+}
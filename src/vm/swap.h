@@ -0,0 +1,16 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A swap slot number that names no slot. */
+#define SWAP_NONE ((size_t) -1)
+
+void swap_init (void);
+size_t swap_out (const void *kpage);
+void swap_in (size_t slot, void *kpage);
+void swap_free (size_t slot);
+size_t swap_copy (size_t slot);
+
+#endif /* vm/swap.h */